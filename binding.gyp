@@ -9,9 +9,14 @@
         "src/hdr_histogram.c",
         "src/hdr_histogram_log.h",
         "src/hdr_histogram_log.c",
+        "src/hdr_histogram_shm.h",
+        "src/hdr_histogram_shm.c",
+        "src/hdr_thread.h",
+        "src/hdr_thread.c",
         "src/hdr_time.h",
         "src/hdr_time.c",
         "hdr_histogram_wrap.cc",
+        "hdr_log_wrap.cc",
         "histogram.cc"
       ],
       "dependencies": [
@@ -2,11 +2,14 @@
 #include "hdr_histogram_wrap.h"
 
 extern "C" {
+#include "hdr_encoding.h"
 #include "hdr_histogram.h"
 #include "hdr_histogram_log.h"
+#include "hdr_histogram_shm.h"
 }
 
 Nan::Persistent<v8::Function> HdrHistogramWrap::constructor;
+Nan::Persistent<v8::FunctionTemplate> HdrHistogramWrap::constructor_template;
 
 NAN_MODULE_INIT(HdrHistogramWrap::Init) {
   v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
@@ -20,20 +23,61 @@ NAN_MODULE_INIT(HdrHistogramWrap::Init) {
   Nan::SetPrototypeMethod(tpl, "stddev", Stddev);
   Nan::SetPrototypeMethod(tpl, "percentile", Percentile);
   Nan::SetPrototypeMethod(tpl, "encode", Encode);
+  Nan::SetPrototypeMethod(tpl, "encodeInto", EncodeInto);
+  Nan::SetPrototypeMethod(tpl, "encodeBound", EncodeBound);
   Nan::SetMethod(tpl, "decode", Decode);
   Nan::SetPrototypeMethod(tpl, "percentiles", Percentiles);
+  Nan::SetPrototypeMethod(tpl, "percentileAtOrBelow", PercentileAtOrBelow);
+  Nan::SetPrototypeMethod(tpl, "countBetween", CountBetween);
   Nan::SetPrototypeMethod(tpl, "reset", Reset);
+  Nan::SetMethod(tpl, "openShared", OpenShared);
+  Nan::SetPrototypeMethod(tpl, "subtract", Subtract);
+  Nan::SetPrototypeMethod(tpl, "shiftValuesLeft", ShiftValuesLeft);
+  Nan::SetPrototypeMethod(tpl, "shiftValuesRight", ShiftValuesRight);
 
+  constructor_template.Reset(tpl);
   constructor.Reset(Nan::GetFunction(tpl).ToLocalChecked());
   Nan::Set(target, Nan::New("HdrHistogram").ToLocalChecked(), Nan::GetFunction(tpl).ToLocalChecked());
 }
 
 HdrHistogramWrap::~HdrHistogramWrap() {
-  if (this->histogram) {
-    delete this->histogram;
+  hdr_encoder_close(this->encoder);
+  if (this->shm) {
+    hdr_histogram_shm_close(this->shm);
+  } else if (this->histogram) {
+    hdr_close(this->histogram);
   }
 }
 
+struct hdr_histogram* HdrHistogramWrap::Sync() {
+  if (this->shm) {
+    return hdr_histogram_shm_sync(this->shm);
+  }
+  return this->histogram;
+}
+
+v8::Local<v8::Object> HdrHistogramWrap::Adopt(struct hdr_histogram* histogram) {
+  v8::Local<v8::Function> cons = Nan::New(constructor);
+  v8::Local<v8::Object> wrap = Nan::NewInstance(cons, 0, NULL).ToLocalChecked();
+
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(wrap);
+
+  hdr_close(obj->histogram);
+  obj->histogram = histogram;
+
+  return wrap;
+}
+
+struct hdr_histogram* HdrHistogramWrap::FromValue(v8::Local<v8::Value> value) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New(constructor_template);
+
+  if (!tpl->HasInstance(value)) {
+    return NULL;
+  }
+
+  return Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(Nan::To<v8::Object>(value).ToLocalChecked())->Sync();
+}
+
 NAN_METHOD(HdrHistogramWrap::New) {
   if (info.IsConstructCall()) {
     int64_t lowest = info[0]->IsUndefined() ? 1 : Nan::To<int64_t>(info[0]).FromJust();
@@ -91,31 +135,33 @@ NAN_METHOD(HdrHistogramWrap::Record) {
   }
 
   value = Nan::To<int64_t>(info[0]).FromJust();
-  bool result = hdr_record_value(obj->histogram, value);
+  bool result = obj->shm
+    ? hdr_histogram_shm_record_value(obj->shm, value)
+    : hdr_record_value(obj->histogram, value);
   info.GetReturnValue().Set(result);
 }
 
 NAN_METHOD(HdrHistogramWrap::Min) {
   HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
-  int64_t value = hdr_min(obj->histogram);
+  int64_t value = hdr_min(obj->Sync());
   info.GetReturnValue().Set((double) value);
 }
 
 NAN_METHOD(HdrHistogramWrap::Max) {
   HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
-  int64_t value = hdr_max(obj->histogram);
+  int64_t value = hdr_max(obj->Sync());
   info.GetReturnValue().Set((double) value);
 }
 
 NAN_METHOD(HdrHistogramWrap::Mean) {
   HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
-  double value = hdr_mean(obj->histogram);
+  double value = hdr_mean(obj->Sync());
   info.GetReturnValue().Set(value);
 }
 
 NAN_METHOD(HdrHistogramWrap::Stddev) {
   HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
-  double value = hdr_stddev(obj->histogram);
+  double value = hdr_stddev(obj->Sync());
   info.GetReturnValue().Set(value);
 }
 
@@ -131,22 +177,80 @@ NAN_METHOD(HdrHistogramWrap::Percentile) {
   }
 
   HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
-  double value = hdr_value_at_percentile(obj->histogram, percentile);
+  double value = hdr_value_at_percentile(obj->Sync(), percentile);
   info.GetReturnValue().Set(value);
 }
 
 NAN_METHOD(HdrHistogramWrap::Encode) {
   HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
-  char *encoded;
-  int result = hdr_log_encode(obj->histogram, &encoded);
-  if (result != 0) {
+  struct hdr_histogram* histogram = obj->Sync();
+
+  if (!obj->encoder && hdr_encoder_init(&obj->encoder) != 0) {
+    return Nan::ThrowError("failed to encode");
+  }
+
+  // Compress into the encoder's scratch buffer first, so that the Buffer is
+  // allocated at the size of the output rather than of its bound.
+  const uint8_t* compressed;
+  size_t compressed_len;
+  if (hdr_encoder_encode(obj->encoder, histogram, &compressed, &compressed_len) != 0) {
+    return Nan::ThrowError("failed to encode");
+  }
+
+  size_t len = hdr_base64_encoded_len(compressed_len);
+  char *encoded = (char*) malloc(len);
+  if (!encoded || hdr_base64_encode(compressed, compressed_len, encoded, len) != 0) {
+    free(encoded);
     return Nan::ThrowError("failed to encode");
   }
-  int len = strlen(encoded);
+
   Nan::MaybeLocal<v8::Object> buf = Nan::NewBuffer(encoded, len);
   info.GetReturnValue().Set(buf.ToLocalChecked());
 }
 
+NAN_METHOD(HdrHistogramWrap::EncodeInto) {
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
+
+  if (info.Length() < 1 || !node::Buffer::HasInstance(info[0])) {
+    return Nan::ThrowError("Missing Buffer");
+  }
+
+  v8::Local<v8::Value> buf = info[0];
+  size_t buf_len = node::Buffer::Length(buf);
+  int64_t offset = info[1]->IsUndefined() ? 0 : Nan::To<int64_t>(info[1]).FromJust();
+
+  if (offset < 0 || (size_t) offset > buf_len) {
+    return Nan::ThrowError("offset out of range");
+  }
+
+  if (!obj->encoder && hdr_encoder_init(&obj->encoder) != 0) {
+    return Nan::ThrowError("failed to encode");
+  }
+
+  // Compress into the encoder's scratch buffer and base64 encode straight
+  // into the caller's buffer, which is not NUL terminated.
+  const uint8_t* compressed;
+  size_t compressed_len;
+  if (hdr_encoder_encode(obj->encoder, obj->Sync(), &compressed, &compressed_len) != 0) {
+    return Nan::ThrowError("failed to encode");
+  }
+
+  size_t len = hdr_base64_encoded_len(compressed_len);
+  if (len > buf_len - (size_t) offset) {
+    return Nan::ThrowError("Buffer too small");
+  }
+
+  hdr_base64_encode(compressed, compressed_len, node::Buffer::Data(buf) + offset, len);
+  info.GetReturnValue().Set((double) len);
+}
+
+NAN_METHOD(HdrHistogramWrap::EncodeBound) {
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
+  // The bound includes the NUL terminator the C API writes.
+  double bound = (double) (hdr_log_encode_bound(obj->Sync()) - 1);
+  info.GetReturnValue().Set(bound);
+}
+
 NAN_METHOD(HdrHistogramWrap::Decode) {
   v8::Local<v8::Value> buf;
   if (info.Length() > 0 && info[0]->IsObject(), node::Buffer::HasInstance(info[0])) {
@@ -172,7 +276,7 @@ NAN_METHOD(HdrHistogramWrap::Percentiles) {
   v8::Local<v8::Array> result = Nan::New<v8::Array>();
 
   hdr_iter iter;
-  hdr_iter_percentile_init(&iter, obj->histogram, 1);
+  hdr_iter_percentile_init(&iter, obj->Sync(), 1);
 
   int count = 0;
 
@@ -195,8 +299,140 @@ NAN_METHOD(HdrHistogramWrap::Percentiles) {
   info.GetReturnValue().Set(result);
 }
 
+NAN_METHOD(HdrHistogramWrap::PercentileAtOrBelow) {
+  if (info[0]->IsUndefined()) {
+    return Nan::ThrowError("No value specified");
+  }
+
+  int64_t value = Nan::To<int64_t>(info[0]).FromJust();
+
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
+  double percentile = hdr_percentile_at_or_below(obj->Sync(), value);
+  info.GetReturnValue().Set(percentile);
+}
+
+NAN_METHOD(HdrHistogramWrap::CountBetween) {
+  if (info[0]->IsUndefined() || info[1]->IsUndefined()) {
+    return Nan::ThrowError("No range specified");
+  }
+
+  int64_t low = Nan::To<int64_t>(info[0]).FromJust();
+  int64_t high = Nan::To<int64_t>(info[1]).FromJust();
+
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
+  int64_t count = hdr_count_between(obj->Sync(), low, high);
+  info.GetReturnValue().Set((double) count);
+}
+
 NAN_METHOD(HdrHistogramWrap::Reset) {
   HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
-  hdr_reset(obj->histogram);
+  if (obj->shm) {
+    hdr_histogram_shm_reset(obj->shm);
+  } else {
+    hdr_reset(obj->histogram);
+  }
+  info.GetReturnValue().Set(info.This());
+}
+
+NAN_METHOD(HdrHistogramWrap::OpenShared) {
+  if (info.Length() < 1 || !info[0]->IsString()) {
+    return Nan::ThrowError("Missing path");
+  }
+
+  Nan::Utf8String path(info[0]);
+  struct hdr_histogram_bucket_config cfg;
+  struct hdr_histogram_bucket_config *cfg_ptr = NULL;
+
+  // without a configuration we attach to a histogram created by another process
+  if (!info[1]->IsUndefined() || !info[2]->IsUndefined() || !info[3]->IsUndefined()) {
+    int64_t lowest = info[1]->IsUndefined() ? 1 : Nan::To<int64_t>(info[1]).FromJust();
+    int64_t highest = info[2]->IsUndefined() ? 100 : Nan::To<int64_t>(info[2]).FromJust();
+    int significant_figures = info[3]->IsUndefined() ? 3 : Nan::To<int>(info[3]).FromJust();
+
+    if (lowest <= 0) {
+      return Nan::ThrowError("The lowest trackable number must be greater than 0");
+    }
+
+    if (significant_figures < 1 || significant_figures > 5) {
+      return Nan::ThrowError("The significant figures must be between 1 and 5 (inclusive)");
+    }
+
+    if (hdr_calculate_bucket_config(lowest, highest, significant_figures, &cfg) != 0) {
+      return Nan::ThrowError("Unable to initialize the Histogram");
+    }
+
+    cfg_ptr = &cfg;
+  }
+
+  struct hdr_histogram_shm *shm;
+  if (hdr_histogram_shm_open(*path, cfg_ptr, &shm) != 0) {
+    return Nan::ThrowError("Unable to open the shared Histogram");
+  }
+
+  const int argc = 0;
+  v8::Local<v8::Function> cons = Nan::New(constructor);
+  v8::Local<v8::Object> wrap = Nan::NewInstance(cons, argc, NULL).ToLocalChecked();
+
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(wrap);
+
+  hdr_close(obj->histogram);
+  obj->histogram = &shm->histogram;
+  obj->shm = shm;
+
+  info.GetReturnValue().Set(wrap);
+}
+
+NAN_METHOD(HdrHistogramWrap::Subtract) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New(constructor_template);
+  if (info.Length() < 1 || !tpl->HasInstance(info[0])) {
+    return Nan::ThrowError("Missing Histogram");
+  }
+
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
+  HdrHistogramWrap* from = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(
+      Nan::To<v8::Object>(info[0]).ToLocalChecked());
+
+  if (obj->shm) {
+    return Nan::ThrowError("Cannot subtract from a shared Histogram");
+  }
+
+  hdr_subtract(obj->histogram, from->Sync());
   info.GetReturnValue().Set(info.This());
 }
+
+static void ShiftValues(
+    const Nan::FunctionCallbackInfo<v8::Value>& info,
+    struct hdr_histogram* histogram,
+    int (*shift)(struct hdr_histogram*, int32_t)) {
+  if (info[0]->IsUndefined()) {
+    return Nan::ThrowError("No binary orders of magnitude specified");
+  }
+
+  int binary_orders = Nan::To<int>(info[0]).FromJust();
+
+  if (binary_orders < 0) {
+    return Nan::ThrowError("binary orders of magnitude must be >= 0");
+  }
+
+  if (shift(histogram, binary_orders) != 0) {
+    return Nan::ThrowError("values would be shifted out of the trackable range");
+  }
+
+  info.GetReturnValue().Set(info.This());
+}
+
+NAN_METHOD(HdrHistogramWrap::ShiftValuesLeft) {
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
+  if (obj->shm) {
+    return Nan::ThrowError("Cannot shift a shared Histogram");
+  }
+  ShiftValues(info, obj->histogram, hdr_shift_values_left);
+}
+
+NAN_METHOD(HdrHistogramWrap::ShiftValuesRight) {
+  HdrHistogramWrap* obj = Nan::ObjectWrap::Unwrap<HdrHistogramWrap>(info.This());
+  if (obj->shm) {
+    return Nan::ThrowError("Cannot shift a shared Histogram");
+  }
+  ShiftValues(info, obj->histogram, hdr_shift_values_right);
+}
@@ -5,15 +5,25 @@
 
 extern "C" {
 #include "hdr_histogram.h"
+#include "hdr_histogram_log.h"
+#include "hdr_histogram_shm.h"
 }
 
 class HdrHistogramWrap : public Nan::ObjectWrap {
  public:
   static void Init(v8::Local<v8::Object> exports);
 
+  // wraps a histogram, taking ownership of it
+  static v8::Local<v8::Object> Adopt(struct hdr_histogram* histogram);
+  // the histogram of an HdrHistogram instance, NULL for any other value
+  static struct hdr_histogram* FromValue(v8::Local<v8::Value> value);
+
  private:
+  HdrHistogramWrap() : histogram(NULL), shm(NULL), encoder(NULL) {}
   ~HdrHistogramWrap();
 
+  struct hdr_histogram* Sync();
+
   static void New(const Nan::FunctionCallbackInfo<v8::Value>& info);
   static void Record(const Nan::FunctionCallbackInfo<v8::Value>& info);
   static void Min(const Nan::FunctionCallbackInfo<v8::Value>& info);
@@ -22,13 +32,24 @@ class HdrHistogramWrap : public Nan::ObjectWrap {
   static void Stddev(const Nan::FunctionCallbackInfo<v8::Value>& info);
   static void Percentile(const Nan::FunctionCallbackInfo<v8::Value>& info);
   static void Encode(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void EncodeInto(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void EncodeBound(const Nan::FunctionCallbackInfo<v8::Value>& info);
   static void Decode(const Nan::FunctionCallbackInfo<v8::Value>& info);
   static void Percentiles(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void PercentileAtOrBelow(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void CountBetween(const Nan::FunctionCallbackInfo<v8::Value>& info);
   static void Reset(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void OpenShared(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void Subtract(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void ShiftValuesLeft(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void ShiftValuesRight(const Nan::FunctionCallbackInfo<v8::Value>& info);
 
   static Nan::Persistent<v8::Function> constructor;
+  static Nan::Persistent<v8::FunctionTemplate> constructor_template;
 
   struct hdr_histogram *histogram;
+  struct hdr_histogram_shm *shm;
+  struct hdr_encoder *encoder;
 };
 
 #endif
@@ -0,0 +1,506 @@
+#include <errno.h>
+#include <vector>
+#include <nan.h>
+#include "hdr_histogram_wrap.h"
+#include "hdr_log_wrap.h"
+
+extern "C" {
+#include "hdr_histogram.h"
+#include "hdr_histogram_log.h"
+#include "hdr_time.h"
+}
+
+Nan::Persistent<v8::Function> HdrLogReaderWrap::constructor;
+Nan::Persistent<v8::Function> HdrLogWriterWrap::constructor;
+
+struct DecodedEntry {
+  double start_timestamp;
+  double end_timestamp;
+  bool has_tag;
+  std::string tag;
+  struct hdr_histogram* histogram;
+};
+
+class LogReadWorker : public Nan::AsyncWorker {
+ public:
+  LogReadWorker(Nan::Callback* callback, v8::Local<v8::Object> self, HdrLogReaderWrap* obj, int32_t count)
+    : Nan::AsyncWorker(callback, "hdr:LogReader"), obj(obj), count(count), eof(false) {
+    SaveToPersistent("reader", self);
+  }
+
+  ~LogReadWorker() {
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (entries[i].histogram) {
+        hdr_close(entries[i].histogram);
+      }
+    }
+  }
+
+  void Execute() {
+    struct hdr_log_entry entry;
+    int rc = obj->Open();
+
+    while (rc == 0 && (int32_t) entries.size() < count) {
+      // entries the filter rejects are skipped before paying for their decoding
+      if ((rc = hdr_log_mmap_next_filtered(&obj->reader, &obj->filter, &entry)) != 0) {
+        break;
+      }
+
+      DecodedEntry decoded;
+      decoded.start_timestamp = hdr_timespec_as_double(&entry.timestamp);
+      decoded.end_timestamp = hdr_timespec_as_double(&entry.interval);
+      decoded.has_tag = entry.tag != NULL;
+      if (decoded.has_tag) {
+        decoded.tag.assign(entry.tag, entry.tag_len);
+      }
+      decoded.histogram = NULL;
+
+      if ((rc = hdr_log_mmap_decode(&obj->reader, &entry, &decoded.histogram)) == 0) {
+        entries.push_back(decoded);
+      }
+    }
+
+    if (rc == EOF) {
+      eof = true;
+    } else if (rc != 0) {
+      SetErrorMessage(hdr_strerror(rc));
+    }
+  }
+
+  void HandleOKCallback() {
+    Finish();
+
+    v8::Local<v8::Array> result = Nan::New<v8::Array>((int) entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+      v8::Local<v8::Object> item = Nan::New<v8::Object>();
+      Nan::Set(item, Nan::New("histogram").ToLocalChecked(), HdrHistogramWrap::Adopt(entries[i].histogram));
+      entries[i].histogram = NULL;
+      Nan::Set(item, Nan::New("startTimestamp").ToLocalChecked(), Nan::New(entries[i].start_timestamp));
+      Nan::Set(item, Nan::New("endTimestamp").ToLocalChecked(), Nan::New(entries[i].end_timestamp));
+      if (entries[i].has_tag) {
+        Nan::Set(item, Nan::New("tag").ToLocalChecked(), Nan::New(entries[i].tag).ToLocalChecked());
+      }
+      Nan::Set(result, (uint32_t) i, item);
+    }
+
+    const int argc = 3;
+    v8::Local<v8::Value> argv[argc] = {
+      Nan::Null(),
+      result,
+      Nan::New(eof)
+    };
+    callback->Call(argc, argv, async_resource);
+  }
+
+  void HandleErrorCallback() {
+    Finish();
+    Nan::AsyncWorker::HandleErrorCallback();
+  }
+
+ private:
+  // a close requested while the chunk was read is carried out now
+  void Finish() {
+    obj->busy = false;
+    if (obj->closed) {
+      obj->Release();
+    }
+  }
+
+  HdrLogReaderWrap* obj;
+  int32_t count;
+  bool eof;
+  std::vector<DecodedEntry> entries;
+};
+
+NAN_MODULE_INIT(HdrLogReaderWrap::Init) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+  tpl->SetClassName(Nan::New("HdrLogReader").ToLocalChecked());
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  Nan::SetPrototypeMethod(tpl, "read", Read);
+  Nan::SetPrototypeMethod(tpl, "close", Close);
+
+  constructor.Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  Nan::Set(target, Nan::New("HdrLogReader").ToLocalChecked(), Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+HdrLogReaderWrap::~HdrLogReaderWrap() {
+  this->Release();
+}
+
+int HdrLogReaderWrap::Open() {
+  if (this->opened) {
+    return 0;
+  }
+
+  int rc = hdr_log_mmap_reader_open(&this->reader, this->path.c_str());
+  this->opened = rc == 0;
+  return rc;
+}
+
+void HdrLogReaderWrap::Release() {
+  if (this->opened) {
+    hdr_log_mmap_reader_close(&this->reader);
+    this->opened = false;
+  }
+}
+
+NAN_METHOD(HdrLogReaderWrap::New) {
+  if (info.IsConstructCall()) {
+    if (info.Length() < 1 || !info[0]->IsString()) {
+      return Nan::ThrowError("Missing path");
+    }
+
+    if (!info[1]->IsUndefined() && !info[1]->IsNull() && !info[1]->IsString()) {
+      return Nan::ThrowError("The tag must be a string");
+    }
+
+    HdrLogReaderWrap *obj = new HdrLogReaderWrap();
+
+    obj->path = *Nan::Utf8String(info[0]);
+    hdr_log_filter_init(&obj->filter);
+    if (info[1]->IsString()) {
+      obj->tag = *Nan::Utf8String(info[1]);
+      obj->filter.tag = obj->tag.c_str();
+    }
+    if (!info[2]->IsUndefined()) {
+      obj->filter.min_interval_max = Nan::To<double>(info[2]).FromJust();
+    }
+    if (!info[3]->IsUndefined()) {
+      obj->filter.start_time = Nan::To<double>(info[3]).FromJust();
+    }
+    if (!info[4]->IsUndefined()) {
+      obj->filter.end_time = Nan::To<double>(info[4]).FromJust();
+    }
+
+    obj->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  } else {
+    const int argc = 5;
+    v8::Local<v8::Value> argv[argc] = {
+      info[0],
+      info[1],
+      info[2],
+      info[3],
+      info[4]
+    };
+    v8::Local<v8::Function> cons = Nan::New(constructor);
+    v8::MaybeLocal<v8::Object> wrap = Nan::NewInstance(cons, argc, argv);
+
+    if (wrap.IsEmpty()) {
+      return;
+    }
+
+    info.GetReturnValue().Set(wrap.ToLocalChecked());
+  }
+}
+
+NAN_METHOD(HdrLogReaderWrap::Read) {
+  HdrLogReaderWrap* obj = Nan::ObjectWrap::Unwrap<HdrLogReaderWrap>(info.This());
+
+  if (!info[1]->IsFunction()) {
+    return Nan::ThrowError("Missing callback");
+  }
+
+  int32_t count = info[0]->IsUndefined() ? 0 : Nan::To<int32_t>(info[0]).FromJust();
+  if (count < 1) {
+    return Nan::ThrowError("The number of entries must be greater than 0");
+  }
+
+  if (obj->closed) {
+    return Nan::ThrowError("The log is closed");
+  }
+
+  if (obj->busy) {
+    return Nan::ThrowError("A read is already in progress");
+  }
+
+  obj->busy = true;
+  Nan::Callback* callback = new Nan::Callback(info[1].As<v8::Function>());
+  Nan::AsyncQueueWorker(new LogReadWorker(callback, info.This(), obj, count));
+}
+
+NAN_METHOD(HdrLogReaderWrap::Close) {
+  HdrLogReaderWrap* obj = Nan::ObjectWrap::Unwrap<HdrLogReaderWrap>(info.This());
+
+  obj->closed = true;
+  if (!obj->busy) {
+    obj->Release();
+  }
+}
+
+class LogCloseWorker : public Nan::AsyncWorker {
+ public:
+  LogCloseWorker(Nan::Callback* callback, v8::Local<v8::Object> self, HdrLogWriterWrap* obj)
+    : Nan::AsyncWorker(callback, "hdr:LogWriter"), obj(obj) {
+    SaveToPersistent("writer", self);
+  }
+
+  void Execute() {
+    // a log with no entries still gets its header
+    int rc = obj->Open();
+    int close_rc = obj->Release();
+
+    if (rc != 0 || (rc = close_rc) != 0) {
+      SetErrorMessage(hdr_strerror(rc));
+    }
+  }
+
+  void HandleOKCallback() {
+    obj->busy = false;
+    Nan::AsyncWorker::HandleOKCallback();
+  }
+
+  void HandleErrorCallback() {
+    obj->busy = false;
+    Nan::AsyncWorker::HandleErrorCallback();
+  }
+
+ private:
+  HdrLogWriterWrap* obj;
+};
+
+class LogWriteWorker : public Nan::AsyncWorker {
+ public:
+  LogWriteWorker(
+      Nan::Callback* callback,
+      v8::Local<v8::Object> self,
+      HdrLogWriterWrap* obj,
+      struct hdr_histogram* histogram,
+      double start_timestamp,
+      double end_timestamp,
+      bool has_tag,
+      const std::string& tag)
+    : Nan::AsyncWorker(callback, "hdr:LogWriter"),
+      obj(obj),
+      histogram(histogram),
+      start_timestamp(start_timestamp),
+      end_timestamp(end_timestamp),
+      has_tag(has_tag),
+      tag(tag) {
+    SaveToPersistent("writer", self);
+  }
+
+  ~LogWriteWorker() {
+    hdr_close(histogram);
+  }
+
+  void Execute() {
+    hdr_timespec start;
+    hdr_timespec end;
+    int rc;
+
+    hdr_timespec_from_double(&start, start_timestamp);
+    hdr_timespec_from_double(&end, end_timestamp);
+
+    if ((rc = obj->Open()) == 0 &&
+        (rc = hdr_log_write_tagged(
+            &obj->writer, obj->file, has_tag ? tag.c_str() : NULL, &start, &end, histogram)) == 0 &&
+        fflush(obj->file) != 0) {
+      rc = EIO;
+    }
+
+    if (rc != 0) {
+      SetErrorMessage(hdr_strerror(rc));
+    }
+  }
+
+  void HandleOKCallback() {
+    Finish();
+    Nan::AsyncWorker::HandleOKCallback();
+  }
+
+  void HandleErrorCallback() {
+    Finish();
+    Nan::AsyncWorker::HandleErrorCallback();
+  }
+
+ private:
+  // a close requested while the entry was written is started now
+  void Finish() {
+    obj->busy = false;
+    if (obj->pending_close) {
+      Nan::Callback* close_callback = obj->pending_close;
+      obj->pending_close = NULL;
+      obj->busy = true;
+      Nan::AsyncQueueWorker(new LogCloseWorker(
+          close_callback, Nan::To<v8::Object>(GetFromPersistent("writer")).ToLocalChecked(), obj));
+    }
+  }
+
+  HdrLogWriterWrap* obj;
+  struct hdr_histogram* histogram;
+  double start_timestamp;
+  double end_timestamp;
+  bool has_tag;
+  std::string tag;
+};
+
+NAN_MODULE_INIT(HdrLogWriterWrap::Init) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+  tpl->SetClassName(Nan::New("HdrLogWriter").ToLocalChecked());
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  Nan::SetPrototypeMethod(tpl, "write", Write);
+  Nan::SetPrototypeMethod(tpl, "close", Close);
+
+  constructor.Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  Nan::Set(target, Nan::New("HdrLogWriter").ToLocalChecked(), Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+HdrLogWriterWrap::~HdrLogWriterWrap() {
+  delete this->pending_close;
+  this->Release();
+}
+
+int HdrLogWriterWrap::Open() {
+  hdr_timespec timestamp;
+  int rc;
+
+  if (this->file) {
+    return 0;
+  }
+
+  if ((this->file = fopen(this->path.c_str(), "w")) == NULL) {
+    return errno;
+  }
+
+  hdr_log_writer_init(&this->writer);
+  hdr_timespec_from_double(&timestamp, this->start_timestamp);
+
+  if ((this->keyframe_interval > 0 &&
+      (rc = hdr_log_writer_enable_deltas(&this->writer, this->keyframe_interval)) != 0) ||
+      (rc = hdr_log_write_header(&this->writer, this->file, NULL, &timestamp)) != 0) {
+    this->Release();
+    return rc;
+  }
+
+  return 0;
+}
+
+int HdrLogWriterWrap::Release() {
+  int rc = 0;
+
+  if (this->file) {
+    hdr_log_writer_close(&this->writer);
+    rc = fclose(this->file) != 0 ? EIO : 0;
+    this->file = NULL;
+  }
+
+  return rc;
+}
+
+NAN_METHOD(HdrLogWriterWrap::New) {
+  if (info.IsConstructCall()) {
+    if (info.Length() < 1 || !info[0]->IsString()) {
+      return Nan::ThrowError("Missing path");
+    }
+
+    double start_timestamp = info[1]->IsUndefined() ? 0 : Nan::To<double>(info[1]).FromJust();
+    int32_t keyframe_interval = info[2]->IsUndefined() ? 0 : Nan::To<int32_t>(info[2]).FromJust();
+
+    if (keyframe_interval < 0) {
+      return Nan::ThrowError("The keyframe interval must not be negative");
+    }
+
+    HdrLogWriterWrap *obj = new HdrLogWriterWrap();
+
+    obj->path = *Nan::Utf8String(info[0]);
+    obj->start_timestamp = start_timestamp;
+    obj->keyframe_interval = keyframe_interval;
+
+    obj->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  } else {
+    const int argc = 3;
+    v8::Local<v8::Value> argv[argc] = {
+      info[0],
+      info[1],
+      info[2]
+    };
+    v8::Local<v8::Function> cons = Nan::New(constructor);
+    v8::MaybeLocal<v8::Object> wrap = Nan::NewInstance(cons, argc, argv);
+
+    if (wrap.IsEmpty()) {
+      return;
+    }
+
+    info.GetReturnValue().Set(wrap.ToLocalChecked());
+  }
+}
+
+NAN_METHOD(HdrLogWriterWrap::Write) {
+  HdrLogWriterWrap* obj = Nan::ObjectWrap::Unwrap<HdrLogWriterWrap>(info.This());
+  struct hdr_histogram* histogram = HdrHistogramWrap::FromValue(info[0]);
+
+  if (histogram == NULL) {
+    return Nan::ThrowError("Missing Histogram");
+  }
+
+  if (!info[1]->IsNumber() || !info[2]->IsNumber()) {
+    return Nan::ThrowError("Missing timestamps");
+  }
+
+  if (!info[3]->IsUndefined() && !info[3]->IsNull() && !info[3]->IsString()) {
+    return Nan::ThrowError("The tag must be a string");
+  }
+
+  if (!info[4]->IsFunction()) {
+    return Nan::ThrowError("Missing callback");
+  }
+
+  if (obj->closed) {
+    return Nan::ThrowError("The log is closed");
+  }
+
+  if (obj->busy) {
+    return Nan::ThrowError("A write is already in progress");
+  }
+
+  // copied on the main thread, so that it can keep recording while the copy is written
+  struct hdr_histogram* copy = NULL;
+  if (hdr_copy(histogram, &copy) != 0) {
+    return Nan::ThrowError("Unable to copy the Histogram");
+  }
+
+  std::string tag;
+  if (info[3]->IsString()) {
+    tag = *Nan::Utf8String(info[3]);
+  }
+
+  obj->busy = true;
+  Nan::Callback* callback = new Nan::Callback(info[4].As<v8::Function>());
+  Nan::AsyncQueueWorker(new LogWriteWorker(
+      callback,
+      info.This(),
+      obj,
+      copy,
+      Nan::To<double>(info[1]).FromJust(),
+      Nan::To<double>(info[2]).FromJust(),
+      info[3]->IsString(),
+      tag));
+}
+
+NAN_METHOD(HdrLogWriterWrap::Close) {
+  HdrLogWriterWrap* obj = Nan::ObjectWrap::Unwrap<HdrLogWriterWrap>(info.This());
+
+  if (!info[0]->IsFunction()) {
+    return Nan::ThrowError("Missing callback");
+  }
+
+  if (obj->closed) {
+    return Nan::ThrowError("The log is closed");
+  }
+
+  obj->closed = true;
+  Nan::Callback* callback = new Nan::Callback(info[0].As<v8::Function>());
+
+  // closing waits for the write in progress, if any
+  if (obj->busy) {
+    obj->pending_close = callback;
+    return;
+  }
+
+  obj->busy = true;
+  Nan::AsyncQueueWorker(new LogCloseWorker(callback, info.This(), obj));
+}
@@ -0,0 +1,73 @@
+#ifndef HDRLOGWRAP_H
+#define HDRLOGWRAP_H
+
+#include <string>
+#include <stdio.h>
+#include <nan.h>
+
+extern "C" {
+#include "hdr_histogram.h"
+#include "hdr_histogram_log.h"
+}
+
+// Reads the entries of an interval log that match a filter in chunks, each
+// chunk parsed and decoded on the threadpool. Only one read may be in
+// progress at a time.
+class HdrLogReaderWrap : public Nan::ObjectWrap {
+ public:
+  static void Init(v8::Local<v8::Object> exports);
+
+  int Open();
+  void Release();
+
+  std::string path;
+  std::string tag;
+  struct hdr_log_filter filter;
+  struct hdr_log_mmap_reader reader;
+  bool opened;
+  bool busy;
+  bool closed;
+
+ private:
+  HdrLogReaderWrap() : opened(false), busy(false), closed(false) {}
+  ~HdrLogReaderWrap();
+
+  static void New(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void Read(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void Close(const Nan::FunctionCallbackInfo<v8::Value>& info);
+
+  static Nan::Persistent<v8::Function> constructor;
+};
+
+// Writes an interval log, encoding and writing each entry on the threadpool.
+// The header is written along with the first entry. Only one write or close
+// may be in progress at a time.
+class HdrLogWriterWrap : public Nan::ObjectWrap {
+ public:
+  static void Init(v8::Local<v8::Object> exports);
+
+  int Open();
+  int Release();
+
+  std::string path;
+  double start_timestamp;
+  int32_t keyframe_interval;
+  FILE* file;
+  struct hdr_log_writer writer;
+  bool busy;
+  bool closed;
+  Nan::Callback* pending_close;
+
+ private:
+  HdrLogWriterWrap()
+    : start_timestamp(0), keyframe_interval(0), file(NULL), busy(false), closed(false), pending_close(NULL) {}
+  ~HdrLogWriterWrap();
+
+  static void New(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void Write(const Nan::FunctionCallbackInfo<v8::Value>& info);
+  static void Close(const Nan::FunctionCallbackInfo<v8::Value>& info);
+
+  static Nan::Persistent<v8::Function> constructor;
+};
+
+#endif
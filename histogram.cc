@@ -1,8 +1,11 @@
 #include <nan.h>
 #include "hdr_histogram_wrap.h"
+#include "hdr_log_wrap.h"
 
 NAN_MODULE_INIT(InitAll) {
   HdrHistogramWrap::Init(target);
+  HdrLogReaderWrap::Init(target);
+  HdrLogWriterWrap::Init(target);
 }
 
 NODE_MODULE(Histogram, InitAll)
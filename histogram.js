@@ -4,5 +4,8 @@ const binary = require('node-pre-gyp')
 const path = require('path')
 const bindingPath = binary.find(path.resolve(path.join(__dirname, './package.json')))
 const binding = require(bindingPath)
+const log = require('./log')(binding)
 
 module.exports = binding.HdrHistogram
+module.exports.LogReader = log.LogReader
+module.exports.LogWriter = log.LogWriter
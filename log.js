@@ -0,0 +1,83 @@
+'use strict'
+
+const { Readable, Writable } = require('stream')
+
+module.exports = function (binding) {
+  class LogReader extends Readable {
+    constructor (path, opts) {
+      opts = opts || {}
+      super({ objectMode: true, highWaterMark: opts.highWaterMark || 64 })
+      this._native = new binding.HdrLogReader(path, opts.tag, opts.minIntervalMax, opts.startTime, opts.endTime)
+      this._chunkSize = opts.chunkSize || 64
+      this._reading = false
+    }
+
+    _read () {
+      if (this._reading) {
+        return
+      }
+      this._reading = true
+      this._native.read(this._chunkSize, (err, entries, eof) => {
+        this._reading = false
+        if (this.destroyed) {
+          return
+        }
+        if (err) {
+          this.destroy(err)
+          return
+        }
+        for (const entry of entries) {
+          this.push(entry)
+        }
+        if (eof) {
+          this._native.close()
+          this.push(null)
+        } else if (entries.length === 0) {
+          // the filter rejected the rest of the log so far
+          this._read()
+        }
+      })
+    }
+
+    _destroy (err, cb) {
+      this._native.close()
+      cb(err)
+    }
+  }
+
+  class LogWriter extends Writable {
+    constructor (path, opts) {
+      opts = opts || {}
+      super({ objectMode: true, highWaterMark: opts.highWaterMark || 16 })
+      const startTime = opts.startTime === undefined ? Date.now() / 1000 : opts.startTime
+      this._native = new binding.HdrLogWriter(path, startTime, opts.keyframeInterval || 0)
+      this._closed = false
+    }
+
+    _write (entry, encoding, cb) {
+      try {
+        this._native.write(entry.histogram, entry.startTimestamp, entry.endTimestamp, entry.tag, cb)
+      } catch (err) {
+        cb(err)
+      }
+    }
+
+    _final (cb) {
+      this._close(cb)
+    }
+
+    _destroy (err, cb) {
+      this._close(() => cb(err))
+    }
+
+    _close (cb) {
+      if (this._closed) {
+        return cb()
+      }
+      this._closed = true
+      this._native.close(cb)
+    }
+  }
+
+  return { LogReader, LogWriter }
+}
@@ -0,0 +1,101 @@
+/**
+ * hdr_log_rollup.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * Rolls an interval log up into coarser intervals, e.g. per second logs into
+ * per minute ones:
+ *
+ *   hdr_log_rollup -t 60 per_second.hlog per_minute.hlog
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <hdr_time.h>
+#include <hdr_histogram_log.h>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4996)
+#endif
+
+static int usage(void)
+{
+    fprintf(stderr, "Usage: hdr_log_rollup (-n <intervals> | -t <seconds>) [<input> [<output>]]\n");
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    FILE* input = stdin;
+    FILE* output = stdout;
+    hdr_timespec period;
+    int32_t intervals = 0;
+    double seconds = 0;
+    char* end;
+    int rc;
+
+    if (argc < 3 || argc > 5)
+    {
+        return usage();
+    }
+
+    if (strcmp(argv[1], "-n") == 0)
+    {
+        long n = strtol(argv[2], &end, 10);
+        if ('\0' != *end || n < 1 || n > INT32_MAX)
+        {
+            return usage();
+        }
+        intervals = (int32_t) n;
+    }
+    else if (strcmp(argv[1], "-t") == 0)
+    {
+        seconds = strtod(argv[2], &end);
+        if ('\0' != *end || !(seconds > 0) || seconds > 1e9)
+        {
+            return usage();
+        }
+        period.tv_sec = (time_t) floor(seconds);
+        period.tv_nsec = (long) ((seconds - floor(seconds)) * 1e9);
+    }
+    else
+    {
+        return usage();
+    }
+
+    if (argc > 3 && (input = fopen(argv[3], "r")) == NULL)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[3], strerror(errno));
+        return 1;
+    }
+
+    if (argc > 4 && (output = fopen(argv[4], "w")) == NULL)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[4], strerror(errno));
+        fclose(input);
+        return 1;
+    }
+
+    rc = hdr_log_rollup(input, output, intervals, 0 < intervals ? NULL : &period);
+    if (rc)
+    {
+        fprintf(stderr, "Failed to roll up log: %s\n", hdr_strerror(rc));
+    }
+
+    if (input != stdin)
+    {
+        fclose(input);
+    }
+    if (output != stdout && fclose(output) != 0 && 0 == rc)
+    {
+        fprintf(stderr, "Failed to write %s: %s\n", argv[4], strerror(errno));
+        rc = EIO;
+    }
+
+    return 0 == rc ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+/**
+ * hdr_async_log_writer.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hdr_async_log_writer.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#define async_log_sync(file) _commit(_fileno(file))
+#else
+#include <unistd.h>
+#define async_log_sync(file) fsync(fileno(file))
+#endif
+
+struct hdr_async_log_entry
+{
+    hdr_timespec start_timestamp;
+    hdr_timespec end_timestamp;
+    struct hdr_histogram* histogram;
+};
+
+static bool same_config(const struct hdr_histogram* a, const struct hdr_histogram* b)
+{
+    return a->lowest_trackable_value == b->lowest_trackable_value &&
+        a->highest_trackable_value == b->highest_trackable_value &&
+        a->significant_figures == b->significant_figures;
+}
+
+/* Takes a written histogram of the same configuration from the pool, the */
+/* writer's mutex must be held.                                           */
+static struct hdr_histogram* pool_take(struct hdr_async_log_writer* writer, const struct hdr_histogram* like)
+{
+    int32_t i;
+
+    for (i = writer->pool_len - 1; i >= 0; i--)
+    {
+        struct hdr_histogram* h = writer->pool[i];
+
+        if (same_config(h, like))
+        {
+            writer->pool[i] = writer->pool[--writer->pool_len];
+            return h;
+        }
+    }
+
+    return NULL;
+}
+
+/* Queues an entry, waiting for space if the queue is full.  The writer's */
+/* mutex must be held.                                                    */
+static void queue_push(
+    struct hdr_async_log_writer* writer,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* end_timestamp,
+    struct hdr_histogram* histogram)
+{
+    struct hdr_async_log_entry* entry;
+
+    while (writer->queue_len == writer->queue_capacity)
+    {
+        hdr_cond_wait(&writer->cond, &writer->mutex);
+    }
+
+    entry = &writer->queue[(writer->queue_head + writer->queue_len) % writer->queue_capacity];
+    entry->start_timestamp = *start_timestamp;
+    entry->end_timestamp = *end_timestamp;
+    entry->histogram = histogram;
+
+    writer->queue_len++;
+    hdr_cond_broadcast(&writer->cond);
+}
+
+static void async_log_run(void* arg)
+{
+    struct hdr_async_log_writer* writer = (struct hdr_async_log_writer*) arg;
+    int32_t unsynced = 0;
+    int error = 0;
+
+    hdr_mutex_lock(&writer->mutex);
+
+    for (;;)
+    {
+        int32_t head, len, i;
+
+        while (0 == writer->queue_len && !writer->closing)
+        {
+            hdr_cond_wait(&writer->cond, &writer->mutex);
+        }
+
+        if (0 == writer->queue_len)
+        {
+            break;
+        }
+
+        /* Entries stay counted in the queue until they are written, so */
+        /* producers never reuse their slots before then.               */
+        head = writer->queue_head;
+        len = writer->queue_len;
+        hdr_mutex_unlock(&writer->mutex);
+
+        for (i = 0; i < len; i++)
+        {
+            struct hdr_async_log_entry* entry = &writer->queue[(head + i) % writer->queue_capacity];
+            int rc;
+
+            if (0 == error)
+            {
+                rc = hdr_log_write(
+                    &writer->writer, writer->file,
+                    &entry->start_timestamp, &entry->end_timestamp, entry->histogram);
+                error = rc;
+            }
+
+            hdr_reset(entry->histogram);
+        }
+
+        if (0 == error && fflush(writer->file) != 0)
+        {
+            error = EIO;
+        }
+
+        unsynced += len;
+        if (0 == error && 0 < writer->sync_interval && writer->sync_interval <= unsynced)
+        {
+            error = async_log_sync(writer->file) != 0 ? EIO : 0;
+            unsynced = 0;
+        }
+
+        hdr_mutex_lock(&writer->mutex);
+
+        for (i = 0; i < len; i++)
+        {
+            struct hdr_histogram* h = writer->queue[(head + i) % writer->queue_capacity].histogram;
+
+            if (writer->pool_len < writer->queue_capacity)
+            {
+                writer->pool[writer->pool_len++] = h;
+            }
+            else
+            {
+                hdr_close(h);
+            }
+        }
+
+        writer->queue_head = (head + len) % writer->queue_capacity;
+        writer->queue_len -= len;
+        writer->error = error;
+        hdr_cond_broadcast(&writer->cond);
+    }
+
+    if (0 == error && 0 < writer->sync_interval && 0 < unsynced && async_log_sync(writer->file) != 0)
+    {
+        writer->error = EIO;
+    }
+
+    hdr_mutex_unlock(&writer->mutex);
+}
+
+int hdr_async_log_writer_init(
+    struct hdr_async_log_writer* writer, FILE* file, int32_t queue_capacity, int32_t sync_interval)
+{
+    if (queue_capacity < 1 || sync_interval < 0)
+    {
+        return EINVAL;
+    }
+
+    memset(writer, 0, sizeof(struct hdr_async_log_writer));
+    writer->file = file;
+    writer->sync_interval = sync_interval;
+    writer->queue_capacity = queue_capacity;
+
+    writer->queue = (struct hdr_async_log_entry*) calloc(
+        (size_t) queue_capacity, sizeof(struct hdr_async_log_entry));
+    writer->pool = (struct hdr_histogram**) calloc((size_t) queue_capacity, sizeof(struct hdr_histogram*));
+
+    if (NULL == writer->queue || NULL == writer->pool)
+    {
+        free(writer->queue);
+        free(writer->pool);
+        return ENOMEM;
+    }
+
+    hdr_log_writer_init(&writer->writer);
+
+    if (hdr_mutex_init(&writer->mutex) != 0)
+    {
+        free(writer->queue);
+        free(writer->pool);
+        return ENOMEM;
+    }
+
+    if (hdr_cond_init(&writer->cond) != 0)
+    {
+        hdr_mutex_destroy(&writer->mutex);
+        free(writer->queue);
+        free(writer->pool);
+        return ENOMEM;
+    }
+
+    if (hdr_thread_create(&writer->thread, async_log_run, writer) != 0)
+    {
+        hdr_cond_destroy(&writer->cond);
+        hdr_mutex_destroy(&writer->mutex);
+        free(writer->queue);
+        free(writer->pool);
+        return EAGAIN;
+    }
+
+    return 0;
+}
+
+int hdr_async_log_write_header(
+    struct hdr_async_log_writer* writer, const char* user_prefix, hdr_timespec* timestamp)
+{
+    return hdr_log_write_header(&writer->writer, writer->file, user_prefix, timestamp);
+}
+
+int hdr_async_log_write(
+    struct hdr_async_log_writer* writer,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* end_timestamp,
+    const struct hdr_histogram* histogram)
+{
+    struct hdr_histogram* copy;
+    int rc;
+
+    hdr_mutex_lock(&writer->mutex);
+    copy = pool_take(writer, histogram);
+    hdr_mutex_unlock(&writer->mutex);
+
+    if ((rc = hdr_copy(histogram, &copy)) != 0)
+    {
+        return rc;
+    }
+
+    hdr_mutex_lock(&writer->mutex);
+    queue_push(writer, start_timestamp, end_timestamp, copy);
+    rc = writer->error;
+    hdr_mutex_unlock(&writer->mutex);
+
+    return rc;
+}
+
+int hdr_async_log_write_owned(
+    struct hdr_async_log_writer* writer,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* end_timestamp,
+    struct hdr_histogram* histogram,
+    struct hdr_histogram** recycled)
+{
+    int rc;
+
+    hdr_mutex_lock(&writer->mutex);
+    *recycled = pool_take(writer, histogram);
+    queue_push(writer, start_timestamp, end_timestamp, histogram);
+    rc = writer->error;
+    hdr_mutex_unlock(&writer->mutex);
+
+    return rc;
+}
+
+int hdr_async_log_flush(struct hdr_async_log_writer* writer)
+{
+    int rc;
+
+    hdr_mutex_lock(&writer->mutex);
+    while (0 < writer->queue_len)
+    {
+        hdr_cond_wait(&writer->cond, &writer->mutex);
+    }
+    rc = writer->error;
+    hdr_mutex_unlock(&writer->mutex);
+
+    return rc;
+}
+
+int hdr_async_log_writer_close(struct hdr_async_log_writer* writer)
+{
+    int32_t i;
+
+    hdr_mutex_lock(&writer->mutex);
+    writer->closing = true;
+    hdr_cond_broadcast(&writer->cond);
+    hdr_mutex_unlock(&writer->mutex);
+
+    hdr_thread_join(&writer->thread);
+
+    for (i = 0; i < writer->pool_len; i++)
+    {
+        hdr_close(writer->pool[i]);
+    }
+
+    hdr_cond_destroy(&writer->cond);
+    hdr_mutex_destroy(&writer->mutex);
+    hdr_log_writer_close(&writer->writer);
+    free(writer->queue);
+    free(writer->pool);
+
+    writer->queue = NULL;
+    writer->pool = NULL;
+    writer->pool_len = 0;
+
+    return writer->error;
+}
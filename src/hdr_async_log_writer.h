@@ -0,0 +1,140 @@
+/**
+ * hdr_async_log_writer.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * An interval log writer that queues histograms and leaves their encoding,
+ * formatting and writing to a background thread, so the thread reporting
+ * each interval does not wait on compression or the disk.
+ */
+
+#ifndef HDR_ASYNC_LOG_WRITER_H
+#define HDR_ASYNC_LOG_WRITER_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hdr_thread.h"
+#include "hdr_time.h"
+#include "hdr_histogram.h"
+#include "hdr_histogram_log.h"
+
+struct hdr_async_log_entry;
+
+struct hdr_async_log_writer
+{
+    /** Used by the background thread once entries are queued. */
+    struct hdr_log_writer writer;
+    FILE* file;
+    int32_t sync_interval;
+    hdr_mutex mutex;
+    hdr_cond cond;
+    hdr_thread thread;
+    struct hdr_async_log_entry* queue;
+    int32_t queue_capacity;
+    int32_t queue_head;
+    int32_t queue_len;
+    /** Written histograms, reset and kept for reuse by later entries. */
+    struct hdr_histogram** pool;
+    int32_t pool_len;
+    int error;
+    bool closing;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise the writer and start its background thread.  The log header and
+ * any options of 'writer->writer', such as delta encoding, must be written
+ * and set before the first entry is queued.
+ *
+ * @param writer 'This' pointer
+ * @param file The stream to write the log to.
+ * @param queue_capacity The number of entries that can be queued before
+ * writes block waiting for the background thread.
+ * @param sync_interval Flush the stream to disk after this many entries have
+ * been written, 0 to leave it to the operating system.
+ * @return 0 on success, EINVAL if the capacity is not positive or the sync
+ * interval is negative, ENOMEM if the queue could not be allocated, EAGAIN if
+ * the thread could not be started.
+ */
+int hdr_async_log_writer_init(
+    struct hdr_async_log_writer* writer, FILE* file, int32_t queue_capacity, int32_t sync_interval);
+
+/**
+ * Write the log header on the calling thread, as hdr_log_write_header.  Must
+ * be called before the first entry is queued.
+ *
+ * @param writer 'This' pointer
+ * @param user_prefix User defined string to include in the header.
+ * @param timestamp The start time that the histogram started recording from.
+ * @return As hdr_log_write_header.
+ */
+int hdr_async_log_write_header(
+    struct hdr_async_log_writer* writer, const char* user_prefix, hdr_timespec* timestamp);
+
+/**
+ * Queue a copy of the histogram.  The copy reuses a histogram of the same
+ * configuration from an earlier entry once that has been written.
+ *
+ * @param writer 'This' pointer
+ * @param start_timestamp The start timestamp of the interval.
+ * @param end_timestamp The end timestamp of the interval.
+ * @param histogram The histogram to copy.
+ * @return 0 on success, ENOMEM if the copy could not be allocated, otherwise
+ * the error of an earlier entry the background thread failed to write.
+ */
+int hdr_async_log_write(
+    struct hdr_async_log_writer* writer,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* end_timestamp,
+    const struct hdr_histogram* histogram);
+
+/**
+ * Queue a histogram without copying it, taking ownership of it.  A reset
+ * histogram of the same configuration from an earlier entry is handed back
+ * in exchange when one has been written, ready to be passed to
+ * hdr_interval_recorder_sample_and_recycle.
+ *
+ * @param writer 'This' pointer
+ * @param start_timestamp The start timestamp of the interval.
+ * @param end_timestamp The end timestamp of the interval.
+ * @param histogram The histogram to queue, freed by the writer.
+ * @param recycled Output parameter to capture a histogram for reuse, NULL if
+ * none is available yet.
+ * @return 0 on success, otherwise the error of an earlier entry the
+ * background thread failed to write.  The histogram is owned by the writer
+ * either way.
+ */
+int hdr_async_log_write_owned(
+    struct hdr_async_log_writer* writer,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* end_timestamp,
+    struct hdr_histogram* histogram,
+    struct hdr_histogram** recycled);
+
+/**
+ * Wait until every queued entry has been written and flushed.
+ *
+ * @param writer 'This' pointer
+ * @return 0 on success, otherwise the first error of the background thread.
+ */
+int hdr_async_log_flush(struct hdr_async_log_writer* writer);
+
+/**
+ * Write the remaining entries, stop the background thread and free the
+ * writer's histograms and buffers.  The stream is left open.
+ *
+ * @param writer 'This' pointer
+ * @return 0 on success, otherwise the first error of the background thread.
+ */
+int hdr_async_log_writer_close(struct hdr_async_log_writer* writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
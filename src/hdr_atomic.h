@@ -11,6 +11,7 @@
 #if defined(_MSC_VER)
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <intrin.h>
 
 static void __inline * hdr_atomic_load_pointer(void** pointer)
@@ -47,6 +48,12 @@ static int64_t __inline hdr_atomic_add_fetch_64(volatile int64_t* field, int64_t
 	return _InterlockedExchangeAdd64(field, value) + value;
 }
 
+static bool __inline hdr_atomic_compare_exchange_64(volatile int64_t* field, int64_t* expected, int64_t desired)
+{
+	int64_t comparand = *expected;
+	return comparand == _InterlockedCompareExchange64(field, desired, comparand);
+}
+
 #elif defined(__ATOMIC_SEQ_CST)
 
 #define hdr_atomic_load_pointer(x) __atomic_load_n(x, __ATOMIC_SEQ_CST)
@@ -55,10 +62,13 @@ static int64_t __inline hdr_atomic_add_fetch_64(volatile int64_t* field, int64_t
 #define hdr_atomic_store_64(f,v) __atomic_store_n(f,v, __ATOMIC_SEQ_CST)
 #define hdr_atomic_exchange_64(f,i) __atomic_exchange_n(f,i, __ATOMIC_SEQ_CST)
 #define hdr_atomic_add_fetch_64(field, value) __atomic_add_fetch(field, value, __ATOMIC_SEQ_CST)
+#define hdr_atomic_compare_exchange_64(field, expected, desired) \
+    __atomic_compare_exchange_n(field, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
 
 #elif defined(__x86_64__)
 
 #include <stdint.h>
+#include <stdbool.h>
 
 static inline void* hdr_atomic_load_pointer(void** pointer)
 {
@@ -96,6 +106,11 @@ static inline int64_t hdr_atomic_add_fetch_64(volatile int64_t* field, int64_t v
     return __sync_add_and_fetch(field, value);
 }
 
+static inline bool hdr_atomic_compare_exchange_64(volatile int64_t* field, int64_t* expected, int64_t desired)
+{
+    return *expected == __sync_val_compare_and_swap(field, *expected, desired);
+}
+
 #else
 
 #error "Unable to determine atomic operations for your platform"
@@ -6,9 +6,11 @@
 
 #include <errno.h>
 #include <stddef.h>
+#include <string.h>
 #include <math.h>
 
 #include "hdr_encoding.h"
+#include "hdr_endian.h"
 #include "hdr_tests.h"
 
 int zig_zag_encode_i64(uint8_t* buffer, int64_t signed_value)
@@ -155,49 +157,614 @@ int zig_zag_decode_i64(const uint8_t* buffer, int64_t* retVal)
     return bytesRead;
 }
 
-static const char base64_table[] =
+/* The bulk kernels below only branch on whether a value fits in a single byte, */
+/* which is the common case for histogram counts and is well predicted.  Longer  */
+/* values are handled without branching on their length, always storing a full  */
+/* 8 byte word plus the 9th byte and always loading 9 bytes, so the buffers they */
+/* work on must be padded, see the header for the exact requirements.            */
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#   if defined(_WIN64)
+#       pragma intrinsic(_BitScanReverse64)
+#   else
+#       pragma intrinsic(_BitScanReverse)
+#   endif
+#endif
+
+/* Number of significant bits in a non-zero value. */
+static int bit_length_64(uint64_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long highest_bit = 0;
+#if defined(_WIN64)
+    _BitScanReverse64(&highest_bit, value);
+#else
+    if (_BitScanReverse(&highest_bit, (unsigned long) (value >> 32)))
     {
-        'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
-        'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
-        'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
-        'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
-        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/', '\0'
+        highest_bit += 32;
+    }
+    else
+    {
+        _BitScanReverse(&highest_bit, (unsigned long) value);
+    }
+#endif
+    return (int) highest_bit + 1;
+#else
+    return 64 - __builtin_clzll(value);
+#endif
+}
+
+/* Encoded length of a value by its number of significant bits, the 9th byte */
+/* carries a full 8 bits.                                                     */
+static const uint8_t encoded_len_for_bits[65] =
+    {
+        1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 3,
+        3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5,
+        5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7,
+        7, 7, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9,
+        9
     };
 
-static char get_base_64(uint32_t _24_bit_value, int shift)
+/* Continuation bits for the first len - 1 bytes of a len byte value. */
+static const uint64_t continuation_bits[MAX_BYTES_LEB128 + 1] =
+    {
+        UINT64_C(0),
+        UINT64_C(0),
+        UINT64_C(0x80),
+        UINT64_C(0x8080),
+        UINT64_C(0x808080),
+        UINT64_C(0x80808080),
+        UINT64_C(0x8080808080),
+        UINT64_C(0x808080808080),
+        UINT64_C(0x80808080808080),
+        UINT64_C(0x8080808080808080)
+    };
+
+static int zig_zag_encode_padded(uint8_t* buffer, int64_t signed_value)
 {
-    uint32_t _6_bit_value = 0x3F & (_24_bit_value >> shift);
-    return base64_table[_6_bit_value];
+    uint64_t value = ((uint64_t) signed_value << 1) ^ (uint64_t) (signed_value >> 63);
+    uint64_t word;
+    int len;
+
+    if (value < 0x80)
+    {
+        buffer[0] = (uint8_t) value;
+        return 1;
+    }
+
+    len = encoded_len_for_bits[bit_length_64(value)];
+
+    /* Spread the low 56 bits into 7 bit groups, one per byte. */
+    word =
+        (value & UINT64_C(0x7F)) |
+        ((value << 1) & UINT64_C(0x7F00)) |
+        ((value << 2) & UINT64_C(0x7F0000)) |
+        ((value << 3) & UINT64_C(0x7F000000)) |
+        ((value << 4) & UINT64_C(0x7F00000000)) |
+        ((value << 5) & UINT64_C(0x7F0000000000)) |
+        ((value << 6) & UINT64_C(0x7F000000000000)) |
+        ((value << 7) & UINT64_C(0x7F00000000000000));
+
+    word = htole64(word | continuation_bits[len]);
+    memcpy(buffer, &word, sizeof(word));
+    buffer[8] = (uint8_t) (value >> 56);
+
+    return len;
 }
 
-static int from_base_64(int c)
+static int zig_zag_decode_padded(const uint8_t* buffer, int64_t* signed_value)
 {
-    if ('A' <= c && c <= 'Z')
+    uint64_t word, stop, lowest_stop, value;
+    int len;
+
+    if (buffer[0] < 0x80)
     {
-        return c - 'A';
+        value = buffer[0];
+        *signed_value = (int64_t) ((value >> 1) ^ (0 - (value & 1)));
+        return 1;
     }
-    else if ('a' <= c && c <= 'z')
+
+    memcpy(&word, buffer, sizeof(word));
+    word = le64toh(word);
+
+    /* The first byte without a continuation bit ends the value, if there is one */
+    /* in the first 8 bytes.  Multiplying its isolated bit by 0x0102..08 moves    */
+    /* its byte position + 1 into the top byte.                                   */
+    stop = ~word & UINT64_C(0x8080808080808080);
+    lowest_stop = stop & (~stop + 1);
+    len = (int) (((lowest_stop >> 7) * UINT64_C(0x0102030405060708)) >> 56);
+    len += MAX_BYTES_LEB128 * (0 == stop);
+    word &= (lowest_stop << 1) - 1;
+
+    value =
+        (word & UINT64_C(0x7F)) |
+        ((word >> 1) & UINT64_C(0x3F80)) |
+        ((word >> 2) & UINT64_C(0x1FC000)) |
+        ((word >> 3) & UINT64_C(0xFE00000)) |
+        ((word >> 4) & UINT64_C(0x7F0000000)) |
+        ((word >> 5) & UINT64_C(0x3F800000000)) |
+        ((word >> 6) & UINT64_C(0x1FC0000000000)) |
+        ((word >> 7) & UINT64_C(0xFE000000000000));
+    value |= ((uint64_t) buffer[8] << 56) & (0 - (uint64_t) (0 == stop));
+
+    *signed_value = (int64_t) ((value >> 1) ^ (0 - (value & 1)));
+
+    return len;
+}
+
+static int zig_zag_encoded_len(int64_t signed_value)
+{
+    uint64_t value = ((uint64_t) signed_value << 1) ^ (uint64_t) (signed_value >> 63);
+    return encoded_len_for_bits[bit_length_64(value | 1)];
+}
+
+/* Index of the first non zero count at or after i, or counts_len.  Histograms */
+/* are mostly zeros, so they are skipped four at a time.                       */
+static int32_t skip_zero_counts(const int64_t* counts, int32_t i, int32_t counts_len)
+{
+    while (i + 4 <= counts_len && 0 == (counts[i] | counts[i + 1] | counts[i + 2] | counts[i + 3]))
     {
-        return (c - 'a') + 26;
+        i += 4;
     }
-    else if ('0' <= c && c <= '9')
+
+    while (i < counts_len && 0 == counts[i])
     {
-        return (c - '0') + 52;
+        i++;
     }
-    else if ('+' == c)
+
+    return i;
+}
+
+int64_t zig_zag_encoded_counts_len(const int64_t* counts, int32_t counts_len, int64_t* zero_run)
+{
+    int64_t len = 0;
+    int64_t zeros = *zero_run;
+    int32_t i = 0;
+
+    while (i < counts_len)
     {
-        return 62;
+        int32_t next = skip_zero_counts(counts, i, counts_len);
+
+        zeros += next - i;
+        i = next;
+
+        if (i == counts_len)
+        {
+            break;
+        }
+
+        if (0 != zeros)
+        {
+            len += zig_zag_encoded_len(-zeros);
+            zeros = 0;
+        }
+
+        len += zig_zag_encoded_len(counts[i]);
+        i++;
     }
-    else if ('/' == c)
+
+    *zero_run = zeros;
+
+    return len;
+}
+
+int32_t zig_zag_encode_counts(uint8_t* buffer, const int64_t* counts, int32_t counts_len, int64_t* zero_run)
+{
+    int32_t data_index = 0;
+    int64_t zeros = *zero_run;
+    int32_t i = 0;
+
+    while (i < counts_len)
     {
-        return 63;
+        int32_t next = skip_zero_counts(counts, i, counts_len);
+
+        zeros += next - i;
+        i = next;
+
+        if (i == counts_len)
+        {
+            break;
+        }
+
+        if (0 != zeros)
+        {
+            data_index += zig_zag_encode_padded(&buffer[data_index], -zeros);
+            zeros = 0;
+        }
+
+        data_index += zig_zag_encode_padded(&buffer[data_index], counts[i]);
+        i++;
     }
-    else if ('=' == c)
+
+    *zero_run = zeros;
+
+    return data_index;
+}
+
+int zig_zag_decode_counts(
+    const uint8_t* buffer, int32_t buffer_len, int64_t* counts, int32_t counts_len, int32_t* bytes_read)
+{
+    int32_t data_index = 0;
+    int32_t counts_index = 0;
+    int64_t value;
+
+    while (data_index < buffer_len && counts_index < counts_len)
     {
-        return 0;
+        data_index += zig_zag_decode_padded(&buffer[data_index], &value);
+
+        if (value < 0)
+        {
+            if (value <= INT32_MIN || -value > counts_len - counts_index)
+            {
+                return EINVAL;
+            }
+
+            counts_index += (int32_t) -value;
+        }
+        else
+        {
+            counts[counts_index] += value;
+            counts_index++;
+        }
+    }
+
+    *bytes_read = data_index;
+
+    return 0;
+}
+
+/* Length of the run of counts equal to counts[i], looking at most limit counts ahead. */
+static int32_t run_length(const int64_t* counts, int32_t i, int32_t counts_len, int32_t limit)
+{
+    int32_t end = counts_len - i < limit ? counts_len : i + limit;
+    int32_t j = i + 1;
+
+    while (j < end && counts[j] == counts[i])
+    {
+        j++;
+    }
+
+    return j - i;
+}
+
+static void store_le64(uint8_t* buffer, uint64_t value)
+{
+    value = htole64(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+static uint64_t load_le64(const uint8_t* buffer)
+{
+    uint64_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return le64toh(value);
+}
+
+/* Segment kinds, held in the low two bits of each segment's tag. */
+#define PACKED_BLOCK 0
+#define PACKED_RUN 1
+#define PACKED_ZEROS 2
+
+/* Tags are unsigned, written as the signed value they are the ZigZag encoding of. */
+static int64_t packed_tag(int64_t len, int kind)
+{
+    uint64_t tag = ((uint64_t) len << 2) | (uint64_t) kind;
+    return (int64_t) ((tag >> 1) ^ (0 - (tag & 1)));
+}
+
+/* Smallest count of a block and the bit width of the largest difference from it. */
+static int packed_block_width(const int64_t* counts, int32_t len, int64_t* base)
+{
+    int64_t min = counts[0];
+    int64_t max = counts[0];
+    int32_t i;
+
+    for (i = 1; i < len; i++)
+    {
+        min = counts[i] < min ? counts[i] : min;
+        max = counts[i] > max ? counts[i] : max;
+    }
+
+    *base = min;
+
+    return max == min ? 0 : bit_length_64((uint64_t) max - (uint64_t) min);
+}
+
+/* Writes counts as a block of values relative to base, packed at width bits. */
+static int32_t packed_encode_block(uint8_t* buffer, const int64_t* counts, int32_t len, int64_t base, int width)
+{
+    uint64_t bits = 0;
+    int32_t filled = 0;
+    int32_t data_index = 0;
+    int32_t i;
+
+    data_index += zig_zag_encode_padded(&buffer[data_index], packed_tag(len, PACKED_BLOCK));
+    buffer[data_index++] = (uint8_t) width;
+    data_index += zig_zag_encode_padded(&buffer[data_index], base);
+
+    if (0 == width)
+    {
+        return data_index;
     }
 
-    return EINVAL;
+    for (i = 0; i < len; i++)
+    {
+        uint64_t value = (uint64_t) counts[i] - (uint64_t) base;
+
+        bits |= value << filled;
+
+        if (filled + width >= 64)
+        {
+            store_le64(&buffer[data_index], bits);
+            data_index += 8;
+            bits = 0 == filled ? 0 : value >> (64 - filled);
+            filled += width - 64;
+        }
+        else
+        {
+            filled += width;
+        }
+    }
+
+    /* The whole word is written, only the bytes holding bits are counted. */
+    store_le64(&buffer[data_index], bits);
+    data_index += (filled + 7) / 8;
+
+    return data_index;
+}
+
+/* Writes counts as runs of equal counts, or gets the length they would take */
+/* when buffer is NULL.                                                       */
+static int32_t packed_encode_runs(uint8_t* buffer, const int64_t* counts, int32_t len)
+{
+    int32_t data_index = 0;
+    int32_t i, run;
+
+    for (i = 0; i < len; i += run)
+    {
+        run = run_length(counts, i, len, INT32_MAX);
+
+        if (0 == counts[i])
+        {
+            data_index += NULL == buffer
+                ? zig_zag_encoded_len(packed_tag(run, PACKED_ZEROS))
+                : zig_zag_encode_padded(&buffer[data_index], packed_tag(run, PACKED_ZEROS));
+        }
+        else if (NULL == buffer)
+        {
+            data_index += zig_zag_encoded_len(packed_tag(run, PACKED_RUN)) + zig_zag_encoded_len(counts[i]);
+        }
+        else
+        {
+            data_index += zig_zag_encode_padded(&buffer[data_index], packed_tag(run, PACKED_RUN));
+            data_index += zig_zag_encode_padded(&buffer[data_index], counts[i]);
+        }
+    }
+
+    return data_index;
+}
+
+int32_t packed_encode_counts(uint8_t* buffer, const int64_t* counts, int32_t counts_len)
+{
+    int32_t data_index = 0;
+    int32_t i = 0;
+
+    while (i < counts_len)
+    {
+        int32_t end = i;
+        int32_t run = run_length(counts, i, counts_len, INT32_MAX);
+        int64_t base, block_len;
+        int width;
+
+        if (run >= PACKED_MIN_RUN_LEN)
+        {
+            data_index += packed_encode_runs(&buffer[data_index], &counts[i], run);
+            i += run;
+            continue;
+        }
+
+        /* Gather counts up to the next long run or a full block. */
+        while (end < counts_len && end - i < PACKED_BLOCK_LEN)
+        {
+            run = run_length(counts, end, counts_len, PACKED_MIN_RUN_LEN);
+            if (run >= PACKED_MIN_RUN_LEN)
+            {
+                break;
+            }
+
+            end += run;
+        }
+
+        end = end - i > PACKED_BLOCK_LEN ? i + PACKED_BLOCK_LEN : end;
+
+        /* Few counts between long runs, as in sparse histograms, are smaller */
+        /* written as short runs than as a block wide enough for all of them.  */
+        width = packed_block_width(&counts[i], end - i, &base);
+        block_len =
+            zig_zag_encoded_len(packed_tag(end - i, PACKED_BLOCK)) + 1 + zig_zag_encoded_len(base) +
+            ((int64_t) (end - i) * width + 7) / 8;
+
+        if (block_len < packed_encode_runs(NULL, &counts[i], end - i))
+        {
+            data_index += packed_encode_block(&buffer[data_index], &counts[i], end - i, base, width);
+        }
+        else
+        {
+            data_index += packed_encode_runs(&buffer[data_index], &counts[i], end - i);
+        }
+
+        i = end;
+    }
+
+    return data_index;
+}
+
+int64_t packed_encoded_counts_bound(int32_t counts_len)
+{
+    /* A run of a single count takes a byte for its tag and up to 9 for the */
+    /* count, blocks are only written when they are smaller.                */
+    return (int64_t) (MAX_BYTES_LEB128 + 1) * ((int64_t) counts_len + 4);
+}
+
+int packed_decode_counts(
+    const uint8_t* buffer, int32_t buffer_len, int64_t* counts, int32_t counts_len, int32_t* bytes_read)
+{
+    int32_t data_index = 0;
+    int32_t counts_index = 0;
+    int64_t signed_tag, base;
+    uint64_t tag, len;
+    int32_t i;
+
+    while (data_index < buffer_len)
+    {
+        data_index += zig_zag_decode_padded(&buffer[data_index], &signed_tag);
+        tag = ((uint64_t) signed_tag << 1) ^ (uint64_t) (signed_tag >> 63);
+        len = tag >> 2;
+
+        if (len < 1 || len > (uint64_t) (counts_len - counts_index))
+        {
+            return EINVAL;
+        }
+
+        if (PACKED_ZEROS == (tag & 3))
+        {
+            counts_index += (int32_t) len;
+            continue;
+        }
+
+        /* Reads stay within the padding as long as each starts inside the buffer. */
+        if (data_index >= buffer_len)
+        {
+            data_index = buffer_len + 1;
+            break;
+        }
+
+        if (PACKED_RUN == (tag & 3))
+        {
+            data_index += zig_zag_decode_padded(&buffer[data_index], &base);
+            if (data_index > buffer_len)
+            {
+                break;
+            }
+
+            if (base < 0)
+            {
+                return EINVAL;
+            }
+
+            if (0 != base)
+            {
+                for (i = 0; i < (int32_t) len; i++)
+                {
+                    counts[counts_index + i] += base;
+                }
+            }
+        }
+        else if (PACKED_BLOCK == (tag & 3))
+        {
+            uint64_t mask, negative = 0;
+            uint64_t bit = 0;
+            int64_t packed_len;
+            int width;
+
+            width = buffer[data_index++];
+            if (data_index >= buffer_len)
+            {
+                data_index = buffer_len + 1;
+                break;
+            }
+
+            data_index += zig_zag_decode_padded(&buffer[data_index], &base);
+
+            if (len > PACKED_BLOCK_LEN || width > 64 || base < 0)
+            {
+                return EINVAL;
+            }
+
+            packed_len = (len * width + 7) / 8;
+            if (data_index + packed_len > buffer_len)
+            {
+                data_index += (int32_t) packed_len;
+                break;
+            }
+
+            mask = 64 == width ? ~UINT64_C(0) : (UINT64_C(1) << width) - 1;
+
+            /* Every value is an unaligned 64 bit load and a shift, a branch free */
+            /* loop at the block's width.  The buffer is padded, as for varints.  */
+            for (i = 0; i < (int32_t) len; i++, bit += (uint64_t) width)
+            {
+                const uint8_t* p = &buffer[data_index + (bit >> 3)];
+                uint32_t shift = (uint32_t) (bit & 7);
+                uint64_t value = load_le64(p) >> shift;
+                int64_t count;
+
+                if (shift + (uint32_t) width > 64)
+                {
+                    value |= (uint64_t) p[8] << (64 - shift);
+                }
+
+                count = (int64_t) ((uint64_t) base + (value & mask));
+                negative |= (uint64_t) count >> 63;
+                counts[counts_index + i] += count;
+            }
+
+            if (negative)
+            {
+                return EINVAL;
+            }
+
+            data_index += (int32_t) packed_len;
+        }
+        else
+        {
+            return EINVAL;
+        }
+
+        counts_index += (int32_t) len;
+    }
+
+    *bytes_read = data_index;
+
+    return 0;
+}
+
+static const char base64_table[] =
+    {
+        'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+        'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+        'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+        'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/', '\0'
+    };
+
+/* The 6 bit value of each character, 0 for the '=' padding and 0xFF for */
+/* characters outside of the base64 alphabet.                            */
+static const uint8_t base64_decode_table[256] =
+    {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+        0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0xFF,
+        0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+        0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+    };
+
+static char get_base_64(uint32_t _24_bit_value, int shift)
+{
+    uint32_t _6_bit_value = 0x3F & (_24_bit_value >> shift);
+    return base64_table[_6_bit_value];
 }
 
 size_t hdr_base64_encoded_len(size_t decoded_size)
@@ -210,6 +777,114 @@ size_t hdr_base64_decoded_len(size_t encoded_size)
     return (encoded_size / 4) * 3;
 }
 
+/* ######  #### ##     ## ########  */
+/* ##    ##  ##  ###   ### ##     ## */
+/* ##        ##  #### #### ##     ## */
+/*  ######   ##  ## ### ## ########  */
+/*       ##  ##  ##     ## ##        */
+/* ##    ##  ##  ##     ## ##        */
+/*  ######  #### ##     ## ##        */
+
+/* SSSE3 kernels translating 12 bytes to 16 characters and back per step,   */
+/* compiled for x86 with GCC and Clang and only used when the CPU running   */
+/* the code supports them.  Other platforms use the table driven loops.     */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#   define HDR_BASE64_SSSE3 1
+#   include <tmmintrin.h>
+#endif
+
+#if defined(HDR_BASE64_SSSE3)
+
+static int base64_has_ssse3(void)
+{
+    return __builtin_cpu_supports("ssse3");
+}
+
+/* Reads 16 bytes for every 12 encoded, returns the number of input bytes encoded. */
+__attribute__((target("ssse3")))
+static size_t base64_encode_ssse3(const uint8_t* input, size_t input_len, char* output)
+{
+    const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m128i offsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    size_t i = 0;
+
+    for (; input_len - i >= 16; i += 12, output += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*) &input[i]);
+        __m128i t0, t1, t2, t3, indices, index_offsets;
+
+        /* Split each 3 bytes into four 6 bit values, one per byte. */
+        in = _mm_shuffle_epi8(in, shuffle);
+        t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        indices = _mm_or_si128(t1, t3);
+
+        /* Map the ranges A-Z, a-z, 0-9, + and / to their offset from the 6 bit value. */
+        index_offsets = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        index_offsets = _mm_sub_epi8(index_offsets, _mm_cmpgt_epi8(indices, _mm_set1_epi8(25)));
+        indices = _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, index_offsets));
+
+        _mm_storeu_si128((__m128i*) output, indices);
+    }
+
+    return i;
+}
+
+/* Writes 16 bytes for every 12 decoded, returns the number of input characters */
+/* decoded.  Stops at the first block holding a character outside the alphabet, */
+/* including '=', leaving it to the table driven loop.                           */
+__attribute__((target("ssse3")))
+static size_t base64_decode_ssse3(const char* input, size_t input_len, uint8_t* output)
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2F);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t i = 0;
+
+    /* 24 characters decode to 18 bytes, leaving room for the 16 byte store. */
+    for (; input_len - i >= 24; i += 16, output += 12)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*) &input[i]);
+        __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+        __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        __m128i roll, merged;
+
+        if (0 != _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())))
+        {
+            break;
+        }
+
+        /* Characters to 6 bit values, then pack four 6 bit values into 3 bytes. */
+        roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f), hi_nibbles));
+        in = _mm_add_epi8(in, roll);
+        merged = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+        merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+
+        _mm_storeu_si128((__m128i*) output, _mm_shuffle_epi8(merged, pack));
+    }
+
+    return i;
+}
+
+#endif
+
+/* ######## ##    ##  ######   #######  ########  ########  */
+/* ##       ###   ## ##    ## ##     ## ##     ## ##        */
+/* ##       ####  ## ##       ##     ## ##     ## ##        */
+/* ######   ## ## ## ##       ##     ## ##     ## ######    */
+/* ##       ##  #### ##       ##     ## ##     ## ##        */
+/* ##       ##   ### ##    ## ##     ## ##     ## ##        */
+/* ######## ##    ##  ######   #######  ########  ########  */
+
 static void hdr_base64_encode_block_pad(const uint8_t* input, char* output, size_t pad)
 {
     uint32_t _24_bit_value = 0;
@@ -258,14 +933,22 @@ void hdr_base64_encode_block(const uint8_t* input, char* output)
 int hdr_base64_encode(
     const uint8_t* input, size_t input_len, char* output, size_t output_len)
 {
-    size_t i, j, remaining;
+    size_t i = 0, j = 0, remaining;
 
     if (hdr_base64_encoded_len(input_len) != output_len)
     {
         return EINVAL;
     }
 
-    for (i = 0, j = 0; input_len - i >= 3 && j < output_len; i += 3, j += 4)
+#if defined(HDR_BASE64_SSSE3)
+    if (base64_has_ssse3())
+    {
+        i = base64_encode_ssse3(input, input_len, output);
+        j = (i / 3) * 4;
+    }
+#endif
+
+    for (; input_len - i >= 3 && j < output_len; i += 3, j += 4)
     {
         hdr_base64_encode_block(&input[i], &output[j]);
     }
@@ -277,27 +960,43 @@ int hdr_base64_encode(
     return 0;
 }
 
-/**
- * Assumes that there is 4 input chars available and 3 output chars.
- */
-void hdr_base64_decode_block(const char* input, uint8_t* output)
-{
-    uint32_t _24_bit_value = 0;
+/* ########  ########  ######   #######  ########  ########  */
+/* ##     ## ##       ##    ## ##     ## ##     ## ##        */
+/* ##     ## ##       ##       ##     ## ##     ## ##        */
+/* ##     ## ######   ##       ##     ## ##     ## ######    */
+/* ##     ## ##       ##       ##     ## ##     ## ##        */
+/* ##     ## ##       ##    ## ##     ## ##     ## ##        */
+/* ########  ########  ######   #######  ########  ########  */
 
-    _24_bit_value |= from_base_64(input[0]) << 18;
-    _24_bit_value |= from_base_64(input[1]) << 12;
-    _24_bit_value |= from_base_64(input[2]) << 6;
-    _24_bit_value |= from_base_64(input[3]);
+/* Returns the 0xFF marker if any of the 4 characters is invalid. */
+static uint8_t base64_decode_block_checked(const char* input, uint8_t* output)
+{
+    uint8_t a = base64_decode_table[(uint8_t) input[0]];
+    uint8_t b = base64_decode_table[(uint8_t) input[1]];
+    uint8_t c = base64_decode_table[(uint8_t) input[2]];
+    uint8_t d = base64_decode_table[(uint8_t) input[3]];
+    uint32_t _24_bit_value = ((uint32_t) a << 18) | ((uint32_t) b << 12) | ((uint32_t) c << 6) | d;
 
     output[0] = (uint8_t) ((_24_bit_value >> 16) & 0xFF);
     output[1] = (uint8_t) ((_24_bit_value >> 8) & 0xFF);
     output[2] = (uint8_t) ((_24_bit_value) & 0xFF);
+
+    return (uint8_t) ((a | b | c | d) & 0xC0);
+}
+
+/**
+ * Assumes that there is 4 input chars available and 3 output chars.
+ */
+void hdr_base64_decode_block(const char* input, uint8_t* output)
+{
+    (void) base64_decode_block_checked(input, output);
 }
 
 int hdr_base64_decode(
     const char* input, size_t input_len, uint8_t* output, size_t output_len)
 {
-    size_t i, j;
+    size_t i = 0, j = 0;
+    uint8_t invalid = 0;
 
     if (input_len < 4 ||
         (input_len & 3) != 0 ||
@@ -306,10 +1005,18 @@ int hdr_base64_decode(
         return EINVAL;
     }
 
-    for (i = 0, j = 0; i < input_len; i += 4, j += 3)
+#if defined(HDR_BASE64_SSSE3)
+    if (base64_has_ssse3())
     {
-        hdr_base64_decode_block(&input[i], &output[j]);
+        i = base64_decode_ssse3(input, input_len, output);
+        j = (i / 4) * 3;
     }
+#endif
 
-    return 0;
+    for (; i < input_len; i += 4, j += 3)
+    {
+        invalid |= base64_decode_block_checked(&input[i], &output[j]);
+    }
+
+    return 0 == invalid ? 0 : EINVAL;
 }
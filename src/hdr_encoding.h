@@ -33,6 +33,107 @@ int zig_zag_encode_i64(uint8_t* buffer, int64_t signed_value);
  */
 int zig_zag_decode_i64(const uint8_t* buffer, int64_t* signed_value);
 
+/**
+ * Writes counts to the buffer in LEB128 ZigZag encoded format, replacing each
+ * run of zeros with a single negative run length, as used by the V2 histogram
+ * encoding.  Counts can be encoded in several pieces: a run of zeros at the end
+ * of counts is not written but carried to the next call in zero_run, which
+ * must start out as 0.  Once all of the counts have been passed in a non zero
+ * zero_run still has to be written as its negated value.
+ *
+ * Values are encoded without branching on their length, so up to
+ * MAX_BYTES_LEB128 bytes may be written for every value, the buffer must have
+ * room for MAX_BYTES_LEB128 * (counts_len + 1) bytes.
+ *
+ * @param buffer the buffer to write to
+ * @param counts the counts to encode
+ * @param counts_len the number of counts to encode
+ * @param zero_run the length of the run of zeros carried between calls
+ * @return the number of bytes of encoded data written to the buffer
+ */
+int32_t zig_zag_encode_counts(uint8_t* buffer, const int64_t* counts, int32_t counts_len, int64_t* zero_run);
+
+/**
+ * Gets the number of bytes zig_zag_encode_counts would write for the counts.
+ *
+ * @param counts the counts to encode
+ * @param counts_len the number of counts to encode
+ * @param zero_run the length of the run of zeros carried between calls
+ * @return the number of bytes of encoded data
+ */
+int64_t zig_zag_encoded_counts_len(const int64_t* counts, int32_t counts_len, int64_t* zero_run);
+
+/**
+ * Reads counts written by zig_zag_encode_counts, adding them to counts.  Runs
+ * of zeros are skipped over, leaving those counts untouched, so decoding into
+ * zeroed counts reproduces the encoded counts and decoding into populated
+ * counts merges them.  Values are decoded without branching
+ * on their length, so the buffer must be readable for MAX_BYTES_LEB128 bytes
+ * past buffer_len.
+ *
+ * @param buffer the buffer to read from
+ * @param buffer_len the number of bytes of encoded data in the buffer
+ * @param counts the counts to add to
+ * @param counts_len the number of counts available
+ * @param bytes_read out value to capture the number of bytes read, greater than
+ * buffer_len if the last value was truncated
+ * @return 0 on success, EINVAL if a run of zeros is invalid or overruns counts_len
+ */
+int zig_zag_decode_counts(
+    const uint8_t* buffer, int32_t buffer_len, int64_t* counts, int32_t counts_len, int32_t* bytes_read);
+
+#define PACKED_BLOCK_LEN 128
+#define PACKED_MIN_RUN_LEN 16
+
+/**
+ * Writes counts in the packed format of the V3 histogram encoding, a sequence
+ * of segments each starting with a LEB128 encoded tag holding the number of
+ * counts in the segment shifted left by two and the segment kind:
+ *
+ * - (len << 2) | 2 is a run of len zero counts.
+ * - (len << 2) | 1 is a run of len copies of the count that follows, as a
+ *   LEB128 ZigZag encoded value.  Runs of PACKED_MIN_RUN_LEN or more equal
+ *   counts are written as runs, as are the counts between them when that is
+ *   smaller than a block.
+ * - (len << 2) is a block of up to PACKED_BLOCK_LEN counts, followed by a byte
+ *   holding the bit width, the smallest count of the block as a LEB128 ZigZag
+ *   encoded value, then the difference of each count from the smallest,
+ *   packed least significant bit first at that width.
+ *
+ * Values are written without branching on their length, the buffer must have
+ * room for packed_encoded_counts_bound(counts_len) bytes.
+ *
+ * @param buffer the buffer to write to
+ * @param counts the counts to encode
+ * @param counts_len the number of counts to encode
+ * @return the number of bytes of encoded data written to the buffer
+ */
+int32_t packed_encode_counts(uint8_t* buffer, const int64_t* counts, int32_t counts_len);
+
+/**
+ * Gets the room packed_encode_counts needs to encode counts_len counts.
+ *
+ * @param counts_len the number of counts to encode
+ * @return the size of buffer required
+ */
+int64_t packed_encoded_counts_bound(int32_t counts_len);
+
+/**
+ * Reads counts written by packed_encode_counts, adding them to counts.  Values
+ * are read with unaligned 64 bit loads, so the buffer must be readable for
+ * MAX_BYTES_LEB128 bytes past buffer_len.
+ *
+ * @param buffer the buffer to read from
+ * @param buffer_len the number of bytes of encoded data in the buffer
+ * @param counts the counts to add to
+ * @param counts_len the number of counts available
+ * @param bytes_read out value to capture the number of bytes read, greater than
+ * buffer_len if the last segment was truncated
+ * @return 0 on success, EINVAL if a segment is invalid or overruns counts_len
+ */
+int packed_decode_counts(
+    const uint8_t* buffer, int32_t buffer_len, int64_t* counts, int32_t counts_len, int32_t* bytes_read);
+
 /**
  * Gets the length in bytes of base64 data, given the input size.
  *
@@ -68,6 +169,8 @@ size_t hdr_base64_decoded_len(size_t encoded_size);
  * @param input_len the size in bytes of the endcoded data
  * @param output the buffer to write the decoded data to
  * @param output_len the number of bytes to write to the output data
+ * @return 0 on success, EINVAL if the lengths do not match or the input holds
+ * characters outside of the base64 alphabet
  */
 int hdr_base64_decode(
     const char* input, size_t input_len, uint8_t* output, size_t output_len);
@@ -58,6 +58,11 @@ static int64_t counts_get_normalised(const struct hdr_histogram* h, int32_t inde
     return counts_get_direct(h, normalize_index(h, index));
 }
 
+static void counts_set_normalised(struct hdr_histogram* h, int32_t index, int64_t value)
+{
+    h->counts[normalize_index(h, index)] = value;
+}
+
 static void counts_inc_normalised(
     struct hdr_histogram* h, int32_t index, int64_t value)
 {
@@ -66,6 +71,33 @@ static void counts_inc_normalised(
     h->total_count += value;
 }
 
+/* Sum of the counts for the logical indexes from..to (inclusive), which map to at */
+/* most two contiguous runs of the counts array.                                  */
+static int64_t counts_sum_range(const struct hdr_histogram* h, int32_t from, int32_t to)
+{
+    int32_t raw_from = normalize_index(h, from);
+    int32_t raw_to = normalize_index(h, to);
+    int64_t total = 0;
+    int32_t i;
+
+    if (raw_to < raw_from)
+    {
+        for (i = raw_from; i < h->counts_len; i++)
+        {
+            total += h->counts[i];
+        }
+
+        raw_from = 0;
+    }
+
+    for (i = raw_from; i <= raw_to; i++)
+    {
+        total += h->counts[i];
+    }
+
+    return total;
+}
+
 static void update_min_max(struct hdr_histogram* h, int64_t value)
 {
     h->min_value = (value < h->min_value && value != 0) ? value : h->min_value;
@@ -222,7 +254,7 @@ void hdr_reset_internal_counters(struct hdr_histogram* h)
     {
         int64_t count_at_index;
 
-        if ((count_at_index = counts_get_direct(h, i)) > 0)
+        if ((count_at_index = counts_get_normalised(h, i)) > 0)
         {
             observed_total_count += count_at_index;
             max_index = i;
@@ -396,9 +428,42 @@ void hdr_reset(struct hdr_histogram *h)
      h->total_count=0;
      h->min_value = INT64_MAX;
      h->max_value = 0;
+     h->normalizing_index_offset = 0;
      memset(h->counts, 0, (sizeof(int64_t) * h->counts_len));
 }
 
+int hdr_copy(const struct hdr_histogram* from, struct hdr_histogram** to)
+{
+    struct hdr_histogram* h = *to;
+    int rc;
+
+    if (NULL == h)
+    {
+        rc = hdr_init(
+            from->lowest_trackable_value, from->highest_trackable_value, from->significant_figures, &h);
+        if (rc)
+        {
+            return rc;
+        }
+    }
+    else if (h->lowest_trackable_value != from->lowest_trackable_value ||
+        h->highest_trackable_value != from->highest_trackable_value ||
+        h->significant_figures != from->significant_figures)
+    {
+        return EINVAL;
+    }
+
+    memcpy(h->counts, from->counts, (size_t) from->counts_len * sizeof(int64_t));
+    h->min_value = from->min_value;
+    h->max_value = from->max_value;
+    h->normalizing_index_offset = from->normalizing_index_offset;
+    h->conversion_ratio = from->conversion_ratio;
+    h->total_count = from->total_count;
+
+    *to = h;
+    return 0;
+}
+
 size_t hdr_get_memory_size(struct hdr_histogram *h)
 {
     return sizeof(struct hdr_histogram) + h->counts_len * sizeof(int64_t);
@@ -514,6 +579,377 @@ int64_t hdr_add_while_correcting_for_coordinated_omission(
 }
 
 
+static bool counts_are_index_aligned(const struct hdr_histogram* a, const struct hdr_histogram* b)
+{
+    return a->counts_len == b->counts_len &&
+        a->unit_magnitude == b->unit_magnitude &&
+        a->sub_bucket_half_count_magnitude == b->sub_bucket_half_count_magnitude &&
+        a->normalizing_index_offset == b->normalizing_index_offset;
+}
+
+static int64_t counts_subtract_at(struct hdr_histogram* h, int32_t index, int64_t count)
+{
+    int64_t current = h->counts[index];
+
+    if (current < count)
+    {
+        h->counts[index] = 0;
+        return count - current;
+    }
+
+    h->counts[index] = current - count;
+    return 0;
+}
+
+int64_t hdr_subtract(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    int64_t dropped = 0;
+
+    if (0 == from->total_count)
+    {
+        return 0;
+    }
+
+    if (counts_are_index_aligned(h, from))
+    {
+        int32_t i;
+        int32_t counts_limit = from->counts_len;
+
+        if (0 == from->normalizing_index_offset)
+        {
+            int32_t len_to_max = counts_index_for(from, from->max_value) + 1;
+            counts_limit = len_to_max < counts_limit ? len_to_max : counts_limit;
+        }
+
+        for (i = 0; i < counts_limit; i++)
+        {
+            int64_t count = from->counts[i];
+
+            if (0 != count)
+            {
+                dropped += counts_subtract_at(h, i, count);
+            }
+        }
+    }
+    else
+    {
+        struct hdr_iter iter;
+        hdr_iter_recorded_init(&iter, from);
+
+        while (hdr_iter_next(&iter))
+        {
+            int32_t index = counts_index_for(h, iter.value);
+
+            if (index < 0 || h->counts_len <= index)
+            {
+                dropped += iter.count;
+            }
+            else
+            {
+                dropped += counts_subtract_at(h, normalize_index(h, index), iter.count);
+            }
+        }
+    }
+
+    hdr_reset_internal_counters(h);
+
+    return dropped;
+}
+
+/* The lowest half bucket (not including the 0 value) can not be scaled by changing the */
+/* normalizing offset, its values are moved to their scaled slots one by one.  All of   */
+/* the half buckets below the current lowest one are empty, as the shift would have     */
+/* overflowed otherwise, and every "to" slot is at a lower index than any "from" slot   */
+/* not yet visited, so a single ascending pass is enough.                                */
+static void shift_lowest_half_bucket_contents_left(
+    struct hdr_histogram* h, int32_t shift_amount, int32_t pre_shift_zero_index)
+{
+    int32_t binary_orders = shift_amount >> h->sub_bucket_half_count_magnitude;
+    int32_t from_index;
+
+    for (from_index = 1; from_index < h->sub_bucket_half_count; from_index++)
+    {
+        int64_t to_value = hdr_value_at_index(h, from_index) << binary_orders;
+        int32_t to_index = counts_index_for(h, to_value);
+        int64_t count_at_from_index = counts_get_direct(h, from_index + pre_shift_zero_index);
+
+        counts_set_normalised(h, to_index, count_at_from_index);
+        h->counts[from_index + pre_shift_zero_index] = 0;
+    }
+}
+
+static void shift_normalizing_index_by_offset(
+    struct hdr_histogram* h, int32_t shift_amount, bool lowest_half_bucket_populated)
+{
+    int64_t zero_value_count = counts_get_normalised(h, 0);
+    int32_t pre_shift_zero_index;
+    int32_t offset;
+
+    counts_set_normalised(h, 0, 0);
+    pre_shift_zero_index = normalize_index(h, 0);
+
+    /* Keep the offset within one wrap of the counts array, as normalize_index expects. */
+    offset = h->normalizing_index_offset + shift_amount;
+    if (offset >= h->counts_len)
+    {
+        offset -= h->counts_len;
+    }
+    else if (offset <= -h->counts_len)
+    {
+        offset += h->counts_len;
+    }
+    h->normalizing_index_offset = offset;
+
+    if (lowest_half_bucket_populated)
+    {
+        shift_lowest_half_bucket_contents_left(h, shift_amount, pre_shift_zero_index);
+    }
+
+    counts_set_normalised(h, 0, zero_value_count);
+}
+
+int hdr_shift_values_left(struct hdr_histogram* h, int32_t binary_orders)
+{
+    int32_t shift_amount;
+    int64_t max_value_before_shift, min_value_before_shift;
+    bool lowest_half_bucket_populated;
+
+    if (binary_orders < 0)
+    {
+        return EINVAL;
+    }
+
+    /* Nothing to do if all of the recorded values are at the 0 value level. */
+    if (0 == binary_orders || h->total_count == counts_get_normalised(h, 0))
+    {
+        return 0;
+    }
+
+    if (binary_orders > h->bucket_count)
+    {
+        return ERANGE;
+    }
+
+    shift_amount = binary_orders << h->sub_bucket_half_count_magnitude;
+
+    /* Overflow if the max value would be shifted past the end of the counts array. */
+    if (counts_index_for(h, h->max_value) >= h->counts_len - shift_amount)
+    {
+        return ERANGE;
+    }
+
+    max_value_before_shift = h->max_value;
+    min_value_before_shift = h->min_value;
+    lowest_half_bucket_populated =
+        min_value_before_shift < ((int64_t) h->sub_bucket_half_count << h->unit_magnitude);
+
+    shift_normalizing_index_by_offset(h, shift_amount, lowest_half_bucket_populated);
+
+    h->max_value = 0;
+    h->min_value = INT64_MAX;
+    update_min_max(h, max_value_before_shift << binary_orders);
+    if (min_value_before_shift < INT64_MAX)
+    {
+        update_min_max(h, min_value_before_shift << binary_orders);
+    }
+
+    return 0;
+}
+
+int hdr_shift_values_right(struct hdr_histogram* h, int32_t binary_orders)
+{
+    int32_t shift_amount;
+    int64_t max_value_before_shift, min_value_before_shift;
+
+    if (binary_orders < 0)
+    {
+        return EINVAL;
+    }
+
+    /* Nothing to do if all of the recorded values are at the 0 value level. */
+    if (0 == binary_orders || h->total_count == counts_get_normalised(h, 0))
+    {
+        return 0;
+    }
+
+    if (binary_orders > h->bucket_count)
+    {
+        return ERANGE;
+    }
+
+    shift_amount = binary_orders << h->sub_bucket_half_count_magnitude;
+
+    /* Shifting any value into the lowest half bucket would lose precision and can */
+    /* not be reversed, so treat it as an underflow.                                 */
+    if (counts_index_for(h, h->min_value) < shift_amount + h->sub_bucket_half_count)
+    {
+        return ERANGE;
+    }
+
+    max_value_before_shift = h->max_value;
+    min_value_before_shift = h->min_value;
+
+    shift_normalizing_index_by_offset(h, -shift_amount, false);
+
+    h->max_value = 0;
+    h->min_value = INT64_MAX;
+    update_min_max(h, max_value_before_shift >> binary_orders);
+    update_min_max(h, min_value_before_shift >> binary_orders);
+
+    return 0;
+}
+
+/* Sums each run of source counts that falls into a single destination slot.  When */
+/* working in place the destination shares the (unshifted) source counts array and */
+/* every destination slot is at or below the source slots it is summed from.       */
+static int64_t downsample_runs(
+    const struct hdr_histogram* src, struct hdr_histogram* dst, bool in_place, int32_t* dst_limit)
+{
+    int64_t dropped = 0;
+    int32_t i = 0;
+    int32_t limit = 0;
+
+    *dst_limit = 0;
+
+    if (0 < src->total_count)
+    {
+        limit = counts_index_for(src, src->max_value) + 1;
+        limit = limit < src->counts_len ? limit : src->counts_len;
+    }
+
+    while (i < limit)
+    {
+        int64_t value = hdr_value_at_index(src, i);
+        int32_t run_end = counts_index_for(src, hdr_next_non_equivalent_value(dst, value));
+        int32_t dst_index = counts_index_for(dst, value);
+        int64_t sum;
+
+        run_end = run_end < limit ? run_end : limit;
+        sum = counts_sum_range(src, i, run_end - 1);
+
+        if (dst_index >= dst->counts_len)
+        {
+            dropped += sum;
+        }
+        else if (in_place)
+        {
+            dst->counts[dst_index] = sum;
+            *dst_limit = dst_index + 1;
+        }
+        else
+        {
+            counts_inc_normalised(dst, dst_index, sum);
+        }
+
+        i = run_end;
+    }
+
+    return dropped;
+}
+
+static int downsample_in_place(struct hdr_histogram* h, struct hdr_histogram_bucket_config* cfg)
+{
+    struct hdr_histogram view;
+    int64_t total_count = h->total_count;
+    int64_t min_value = h->min_value;
+    int64_t max_value = h->max_value;
+    int64_t dropped;
+    int64_t* counts;
+    int32_t dst_limit;
+
+    hdr_init_preallocated(&view, cfg);
+
+    if (0 == h->normalizing_index_offset)
+    {
+        view.counts = h->counts;
+        dropped = downsample_runs(h, &view, true, &dst_limit);
+        memset(&view.counts[dst_limit], 0, sizeof(int64_t) * (size_t) (view.counts_len - dst_limit));
+
+        /* Shrinking can not really fail, keep the larger array if it does. */
+        if ((counts = realloc(h->counts, sizeof(int64_t) * (size_t) view.counts_len)) != NULL)
+        {
+            h->counts = counts;
+        }
+    }
+    else
+    {
+        if ((counts = calloc((size_t) view.counts_len, sizeof(int64_t))) == NULL)
+        {
+            return ENOMEM;
+        }
+
+        view.counts = counts;
+        dropped = downsample_runs(h, &view, false, &dst_limit);
+        free(h->counts);
+        h->counts = counts;
+    }
+
+    hdr_init_preallocated(h, cfg);
+
+    if (0 != dropped)
+    {
+        hdr_reset_internal_counters(h);
+    }
+    else
+    {
+        h->total_count = total_count;
+        h->min_value = min_value;
+        h->max_value = max_value;
+    }
+
+    return 0;
+}
+
+int hdr_downsample(struct hdr_histogram* src, int significant_figures, struct hdr_histogram** dst)
+{
+    struct hdr_histogram_bucket_config cfg;
+    int32_t dst_limit;
+    int r;
+
+    if (significant_figures > src->significant_figures)
+    {
+        return EINVAL;
+    }
+
+    r = hdr_calculate_bucket_config(
+        src->lowest_trackable_value, src->highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    if (src == *dst)
+    {
+        return downsample_in_place(src, &cfg);
+    }
+
+    if (NULL == *dst)
+    {
+        r = hdr_init(src->lowest_trackable_value, src->highest_trackable_value, significant_figures, dst);
+        if (r)
+        {
+            return r;
+        }
+    }
+    else if ((*dst)->unit_magnitude != cfg.unit_magnitude ||
+        (*dst)->sub_bucket_half_count_magnitude != cfg.sub_bucket_half_count_magnitude)
+    {
+        return EINVAL;
+    }
+
+    if (0 != downsample_runs(src, *dst, false, &dst_limit))
+    {
+        hdr_reset_internal_counters(*dst);
+    }
+    else if (0 < src->total_count)
+    {
+        update_min_max(*dst, src->min_value);
+        update_min_max(*dst, src->max_value);
+    }
+
+    return 0;
+}
+
 
 /* ##     ##    ###    ##       ##     ## ########  ######  */
 /* ##     ##   ## ##   ##       ##     ## ##       ##    ## */
@@ -627,6 +1063,69 @@ int64_t hdr_count_at_index(const struct hdr_histogram* h, int32_t index)
     return counts_get_normalised(h, index);
 }
 
+static int32_t clamped_counts_index_for(const struct hdr_histogram* h, int64_t value)
+{
+    int32_t index = counts_index_for(h, value);
+    return index < h->counts_len ? index : h->counts_len - 1;
+}
+
+/* Sum of the counts for the logical indexes from..to (inclusive), only visiting the */
+/* occupied part of the histogram and summing whichever side of the range is shorter. */
+static int64_t count_in_index_range(const struct hdr_histogram* h, int32_t from, int32_t to)
+{
+    int32_t lowest_index = 0 < counts_get_normalised(h, 0) ? 0 : clamped_counts_index_for(h, h->min_value);
+    int32_t highest_index = clamped_counts_index_for(h, h->max_value);
+    int32_t inside, outside;
+
+    from = from > lowest_index ? from : lowest_index;
+    to = to < highest_index ? to : highest_index;
+
+    if (to < from)
+    {
+        return 0;
+    }
+
+    inside = to - from + 1;
+    outside = (highest_index - lowest_index + 1) - inside;
+
+    if (inside <= outside)
+    {
+        return counts_sum_range(h, from, to);
+    }
+
+    return h->total_count -
+        (from > lowest_index ? counts_sum_range(h, lowest_index, from - 1) : 0) -
+        (to < highest_index ? counts_sum_range(h, to + 1, highest_index) : 0);
+}
+
+double hdr_percentile_at_or_below(const struct hdr_histogram* h, int64_t value)
+{
+    if (0 == h->total_count)
+    {
+        return 100.0;
+    }
+
+    if (value < 0)
+    {
+        return 0.0;
+    }
+
+    return (100.0 * count_in_index_range(h, 0, clamped_counts_index_for(h, value))) / h->total_count;
+}
+
+int64_t hdr_count_between(const struct hdr_histogram* h, int64_t low_value, int64_t high_value)
+{
+    if (0 == h->total_count || high_value < 0 || high_value < low_value)
+    {
+        return 0;
+    }
+
+    return count_in_index_range(
+        h,
+        low_value > 0 ? counts_index_for(h, low_value) : 0,
+        clamped_counts_index_for(h, high_value));
+}
+
 
 /* #### ######## ######## ########     ###    ########  #######  ########   ######  */
 /*  ##     ##    ##       ##     ##   ## ##      ##    ##     ## ##     ## ##    ## */
@@ -91,6 +91,18 @@ int hdr_alloc(int64_t highest_trackable_value, int significant_figures, struct h
  */
 void hdr_reset(struct hdr_histogram* h);
 
+/**
+ * Copy the counts and statistics of a histogram, e.g. to hand a snapshot of it
+ * to another thread while it keeps recording.
+ *
+ * @param from The histogram to copy.
+ * @param to Pointer to a histogram with the same configuration as 'from' to
+ * copy into, or to NULL to allocate the copy.
+ * @return 0 on success, EINVAL if the configurations differ, ENOMEM if the copy
+ * could not be allocated.
+ */
+int hdr_copy(const struct hdr_histogram* from, struct hdr_histogram** to);
+
 /**
  * Get the memory size of the hdr_histogram.
  *
@@ -178,6 +190,72 @@ int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from);
 int64_t hdr_add_while_correcting_for_coordinated_omission(
     struct hdr_histogram* h, struct hdr_histogram* from, int64_t expected_interval);
 
+/**
+ * Subtracts all of the values in 'from' from 'this' histogram and recomputes
+ * its total count, min and max.  Meant for turning a monotonically growing
+ * cumulative histogram into the delta since an earlier snapshot of it.  When
+ * both histograms share the same configuration the counts arrays are
+ * subtracted index by index, otherwise the recorded values of 'from' are
+ * looked up in 'h'.  Will return the number of values that could not be
+ * removed, either because they are outside of the range of 'h' or because
+ * 'h' holds fewer values at that level than 'from'.  The counts of 'h' never
+ * go below zero.
+ *
+ * @param h "This" pointer
+ * @param from Histogram to subtract values of.
+ * @return The number of values that could not be removed.
+ */
+int64_t hdr_subtract(struct hdr_histogram* h, const struct hdr_histogram* from);
+
+/**
+ * Shift all of the recorded values left by a number of binary orders of
+ * magnitude, i.e. multiply them by 2^binary_orders.  Useful for converting
+ * between units.  The shift is done by moving the normalizing index offset,
+ * so it is O(1) unless values were recorded in the lowest half bucket, which
+ * has to be moved slot by slot.
+ *
+ * @param h "This" pointer
+ * @param binary_orders The number of binary orders of magnitude to shift by.
+ * @return 0 on success, EINVAL if binary_orders is negative, ERANGE if the
+ * max value would overflow the trackable range, in which case the histogram
+ * is left unchanged.
+ */
+int hdr_shift_values_left(struct hdr_histogram* h, int32_t binary_orders);
+
+/**
+ * Shift all of the recorded values right by a number of binary orders of
+ * magnitude, i.e. divide them by 2^binary_orders.  Useful for converting
+ * between units.  The shift is done by moving the normalizing index offset
+ * and is O(1).
+ *
+ * @param h "This" pointer
+ * @param binary_orders The number of binary orders of magnitude to shift by.
+ * @return 0 on success, EINVAL if binary_orders is negative, ERANGE if any
+ * value would be shifted into the lowest half bucket and lose precision, in
+ * which case the histogram is left unchanged.
+ */
+int hdr_shift_values_right(struct hdr_histogram* h, int32_t binary_orders);
+
+/**
+ * Produce a coarser copy of a histogram with fewer significant figures, e.g.
+ * for archiving old data.  Each run of counts that falls into a single slot
+ * of the coarser histogram is summed directly, without re-recording values.
+ *
+ * If *dst is NULL a new histogram with the same trackable range is allocated
+ * and it becomes the callers responsibility to close it.  If *dst is src the
+ * histogram is downsampled in place and its counts array is shrunk.  Otherwise
+ * the counts are added to *dst, which must have the same lowest trackable value
+ * and been initialised with significant_figures.
+ *
+ * @param src The histogram to downsample.
+ * @param significant_figures The precision of the result, at most the precision of src.
+ * @param dst Pointer to allocate a histogram to, or to merge into.
+ * @return 0 on success, EINVAL if significant_figures is invalid or greater
+ * than the precision of src, or *dst does not have the matching layout,
+ * ENOMEM if malloc failed.
+ */
+int hdr_downsample(struct hdr_histogram* src, int significant_figures, struct hdr_histogram** dst);
+
 /**
  * Get minimum value from the histogram.  Will return 2^63-1 if the histogram
  * is empty.
@@ -252,6 +330,33 @@ int64_t hdr_lowest_equivalent_value(const struct hdr_histogram* h, int64_t value
  */
 int64_t hdr_count_at_value(const struct hdr_histogram* h, int64_t value);
 
+/**
+ * Get the percentage of recorded values that are at or below a given value
+ * (to within the histogram resolution at the value level).  Only the
+ * occupied part of the counts array is visited, from whichever end is closer
+ * to the value.
+ *
+ * @param h "This" pointer
+ * @param value The value for which to provide the percentile
+ * @return The percentage of values recorded in the histogram that are at or below
+ * the given value, 100.0 if the histogram is empty.
+ */
+double hdr_percentile_at_or_below(const struct hdr_histogram* h, int64_t value);
+
+/**
+ * Get the count of recorded values within a range of values (to within the
+ * histogram resolution at the value level).  Only the occupied part of the
+ * counts array is visited, summing either the range or its complement,
+ * whichever is shorter.
+ *
+ * @param h "This" pointer
+ * @param low_value The lower value bound on the range for which to provide the recorded count
+ * @param high_value The higher value bound on the range for which to provide the recorded count
+ * @return The total count of values recorded in the histogram within the value range that is
+ * {@literal >=} lowestEquivalentValue(<i>low_value</i>) and {@literal <=} highestEquivalentValue(<i>high_value</i>)
+ */
+int64_t hdr_count_between(const struct hdr_histogram* h, int64_t low_value, int64_t high_value);
+
 int64_t hdr_count_at_index(const struct hdr_histogram* h, int32_t index);
 
 int64_t hdr_value_at_index(const struct hdr_histogram* h, int32_t index);
@@ -0,0 +1,890 @@
+/**
+ * hdr_histogram_binary_log.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "hdr_encoding.h"
+#include "hdr_histogram.h"
+#include "hdr_histogram_log.h"
+#include "hdr_histogram_binary_log.h"
+
+#if defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4996)
+#endif
+
+#include "hdr_endian.h"
+
+#if defined(_MSC_VER)
+#define binary_log_seek _fseeki64
+#define binary_log_tell _ftelli64
+#else
+#define binary_log_seek fseeko
+#define binary_log_tell ftello
+#endif
+
+#define FAIL_AND_CLEANUP(label, error_name, error) \
+    do                      \
+    {                       \
+        error_name = error; \
+        goto label;         \
+    }                       \
+    while (0)
+
+static const int32_t BINARY_LOG_COOKIE         = 0x1c8493b0;
+static const int32_t BINARY_LOG_RECORD_COOKIE  = 0x1c8493b1;
+static const int32_t BINARY_LOG_TRAILER_COOKIE = 0x1c8493b2;
+static const int32_t BINARY_LOG_VERSION        = 1;
+
+typedef struct /*__attribute__((__packed__))*/
+{
+    int32_t cookie;
+    int32_t version;
+    int64_t start_sec;
+    int32_t start_nsec;
+    int32_t reserved;
+} _binary_log_header;
+
+/* Precedes the tag and encoded histogram of every entry. */
+typedef struct /*__attribute__((__packed__))*/
+{
+    int32_t cookie;
+    int32_t length;
+    int32_t tag_len;
+    int32_t timestamp_nsec;
+    int64_t timestamp_sec;
+    int64_t interval_sec;
+    int32_t interval_nsec;
+    int32_t reserved;
+    int64_t max_value;
+} _binary_log_record;
+
+/* The index is followed by the tags it refers to, each as its length and bytes. */
+struct hdr_binary_log_index_entry
+{
+    int64_t offset;
+    int64_t timestamp_sec;
+    int64_t interval_sec;
+    int64_t max_value;
+    int32_t timestamp_nsec;
+    int32_t interval_nsec;
+    int32_t length;
+    int32_t tag_id;
+};
+
+/* Last bytes of a log whose writer was closed. */
+typedef struct /*__attribute__((__packed__))*/
+{
+    int64_t index_offset;
+    int64_t index_len;
+    int32_t tags_len;
+    int32_t cookie;
+} _binary_log_trailer;
+
+#define SIZEOF_BINARY_LOG_HEADER sizeof(_binary_log_header)
+#define SIZEOF_BINARY_LOG_RECORD sizeof(_binary_log_record)
+#define SIZEOF_BINARY_LOG_INDEX_ENTRY sizeof(struct hdr_binary_log_index_entry)
+#define SIZEOF_BINARY_LOG_TRAILER sizeof(_binary_log_trailer)
+
+/* Grows an array of elements of the given size, keeping its contents. */
+static int grow_array(void** array, size_t* capacity, size_t len, size_t element_size)
+{
+    size_t grown_capacity = 0 == *capacity ? 16 : *capacity * 2;
+    void* grown;
+
+    if (len <= *capacity)
+    {
+        return 0;
+    }
+
+    grown_capacity = grown_capacity < len ? len : grown_capacity;
+    if ((grown = realloc(*array, grown_capacity * element_size)) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    *array = grown;
+    *capacity = grown_capacity;
+
+    return 0;
+}
+
+/* Finds a tag in the table, adding a copy of it if it is not there yet. */
+static int intern_tag(
+    char*** tags, int32_t* tags_len, size_t* tags_capacity, const char* tag, size_t tag_len, int32_t* tag_id)
+{
+    char* copy;
+    int32_t i;
+
+    for (i = 0; i < *tags_len; i++)
+    {
+        if (strlen((*tags)[i]) == tag_len && memcmp((*tags)[i], tag, tag_len) == 0)
+        {
+            *tag_id = i;
+            return 0;
+        }
+    }
+
+    if (*tags_len == INT32_MAX ||
+        grow_array((void**) tags, tags_capacity, (size_t) *tags_len + 1, sizeof(char*)) != 0 ||
+        (copy = (char*) malloc(tag_len + 1)) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    memcpy(copy, tag, tag_len);
+    copy[tag_len] = '\0';
+
+    (*tags)[*tags_len] = copy;
+    *tag_id = (*tags_len)++;
+
+    return 0;
+}
+
+static void free_tags(char** tags, int32_t tags_len)
+{
+    int32_t i;
+
+    for (i = 0; i < tags_len; i++)
+    {
+        free(tags[i]);
+    }
+
+    free(tags);
+}
+
+/* ##      ## ########  #### ######## ######## ########  */
+/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
+/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
+/* ##  ##  ## ########   ##     ##    ######   ########  */
+/* ##  ##  ## ##   ##    ##     ##    ##       ##   ##   */
+/* ##  ##  ## ##    ##   ##     ##    ##       ##    ##  */
+/*  ###  ###  ##     ## ####    ##    ######## ##     ## */
+
+int hdr_binary_log_writer_init(
+    struct hdr_binary_log_writer* writer, FILE* file, const hdr_timespec* start_timestamp)
+{
+    _binary_log_header header;
+
+    memset(writer, 0, sizeof(struct hdr_binary_log_writer));
+    writer->file = file;
+
+    header.cookie     = htobe32(BINARY_LOG_COOKIE);
+    header.version    = htobe32(BINARY_LOG_VERSION);
+    header.start_sec  = htobe64((int64_t) start_timestamp->tv_sec);
+    header.start_nsec = htobe32((int32_t) start_timestamp->tv_nsec);
+    header.reserved   = 0;
+
+    if (fwrite(&header, SIZEOF_BINARY_LOG_HEADER, 1, file) != 1)
+    {
+        return EIO;
+    }
+
+    writer->position = SIZEOF_BINARY_LOG_HEADER;
+
+    return 0;
+}
+
+int hdr_binary_log_write_encoded(
+    struct hdr_binary_log_writer* writer,
+    const char* tag,
+    const hdr_timespec* timestamp,
+    const hdr_timespec* interval,
+    int64_t max_value,
+    const uint8_t* data,
+    size_t length)
+{
+    struct hdr_binary_log_index_entry* entry;
+    _binary_log_record record;
+    size_t tag_len = NULL == tag ? 0 : strlen(tag);
+    int32_t tag_id = -1;
+
+    if (length > INT32_MAX || tag_len > INT32_MAX)
+    {
+        return EINVAL;
+    }
+
+    if (NULL != tag && intern_tag(&writer->tags, &writer->tags_len, &writer->tags_capacity, tag, tag_len, &tag_id))
+    {
+        return ENOMEM;
+    }
+
+    if (grow_array(
+        (void**) &writer->index, &writer->index_capacity, (size_t) writer->index_len + 1,
+        SIZEOF_BINARY_LOG_INDEX_ENTRY))
+    {
+        return ENOMEM;
+    }
+
+    record.cookie         = htobe32(BINARY_LOG_RECORD_COOKIE);
+    record.length         = htobe32((int32_t) length);
+    record.tag_len        = htobe32((int32_t) tag_len);
+    record.timestamp_nsec = htobe32((int32_t) timestamp->tv_nsec);
+    record.timestamp_sec  = htobe64((int64_t) timestamp->tv_sec);
+    record.interval_sec   = htobe64((int64_t) interval->tv_sec);
+    record.interval_nsec  = htobe32((int32_t) interval->tv_nsec);
+    record.reserved       = 0;
+    record.max_value      = htobe64(max_value);
+
+    if (fwrite(&record, SIZEOF_BINARY_LOG_RECORD, 1, writer->file) != 1 ||
+        (0 < tag_len && fwrite(tag, 1, tag_len, writer->file) != tag_len) ||
+        fwrite(data, 1, length, writer->file) != length)
+    {
+        return EIO;
+    }
+
+    entry = &writer->index[writer->index_len++];
+    entry->offset         = writer->position;
+    entry->timestamp_sec  = (int64_t) timestamp->tv_sec;
+    entry->interval_sec   = (int64_t) interval->tv_sec;
+    entry->max_value      = max_value;
+    entry->timestamp_nsec = (int32_t) timestamp->tv_nsec;
+    entry->interval_nsec  = (int32_t) interval->tv_nsec;
+    entry->length         = (int32_t) length;
+    entry->tag_id         = tag_id;
+
+    writer->position += (int64_t) (SIZEOF_BINARY_LOG_RECORD + tag_len + length);
+
+    return 0;
+}
+
+int hdr_binary_log_write(
+    struct hdr_binary_log_writer* writer,
+    const char* tag,
+    const hdr_timespec* timestamp,
+    const hdr_timespec* interval,
+    const struct hdr_histogram* histogram)
+{
+    const uint8_t* data;
+    size_t length;
+    int rc;
+
+    if (NULL == writer->encoder && (rc = hdr_encoder_init(&writer->encoder)) != 0)
+    {
+        return rc;
+    }
+
+    if ((rc = hdr_encoder_encode(writer->encoder, histogram, &data, &length)) != 0)
+    {
+        return rc;
+    }
+
+    return hdr_binary_log_write_encoded(writer, tag, timestamp, interval, hdr_max(histogram), data, length);
+}
+
+int hdr_binary_log_writer_close(struct hdr_binary_log_writer* writer)
+{
+    _binary_log_trailer trailer;
+    int64_t i;
+    int32_t t;
+    int result = 0;
+
+    for (i = 0; 0 == result && i < writer->index_len; i++)
+    {
+        struct hdr_binary_log_index_entry entry = writer->index[i];
+
+        entry.offset         = htobe64(entry.offset);
+        entry.timestamp_sec  = htobe64(entry.timestamp_sec);
+        entry.interval_sec   = htobe64(entry.interval_sec);
+        entry.max_value      = htobe64(entry.max_value);
+        entry.timestamp_nsec = htobe32(entry.timestamp_nsec);
+        entry.interval_nsec  = htobe32(entry.interval_nsec);
+        entry.length         = htobe32(entry.length);
+        entry.tag_id         = htobe32(entry.tag_id);
+
+        if (fwrite(&entry, SIZEOF_BINARY_LOG_INDEX_ENTRY, 1, writer->file) != 1)
+        {
+            result = EIO;
+        }
+    }
+
+    for (t = 0; 0 == result && t < writer->tags_len; t++)
+    {
+        size_t tag_len = strlen(writer->tags[t]);
+        int32_t encoded_len = htobe32((int32_t) tag_len);
+
+        if (fwrite(&encoded_len, sizeof(encoded_len), 1, writer->file) != 1 ||
+            fwrite(writer->tags[t], 1, tag_len, writer->file) != tag_len)
+        {
+            result = EIO;
+        }
+    }
+
+    trailer.index_offset = htobe64(writer->position);
+    trailer.index_len    = htobe64(writer->index_len);
+    trailer.tags_len     = htobe32(writer->tags_len);
+    trailer.cookie       = htobe32(BINARY_LOG_TRAILER_COOKIE);
+
+    if (0 == result && fwrite(&trailer, SIZEOF_BINARY_LOG_TRAILER, 1, writer->file) != 1)
+    {
+        result = EIO;
+    }
+
+    hdr_encoder_close(writer->encoder);
+    free(writer->index);
+    free_tags(writer->tags, writer->tags_len);
+    memset(writer, 0, sizeof(struct hdr_binary_log_writer));
+
+    return result;
+}
+
+/* ########  ########    ###    ########  ######## ########  */
+/* ##     ## ##         ## ##   ##     ## ##       ##     ## */
+/* ##     ## ##        ##   ##  ##     ## ##       ##     ## */
+/* ########  ######   ##     ## ##     ## ######   ########  */
+/* ##   ##   ##       ######### ##     ## ##       ##   ##   */
+/* ##    ##  ##       ##     ## ##     ## ##       ##    ##  */
+/* ##     ## ######## ##     ## ########  ######## ##     ## */
+
+static int read_at(struct hdr_binary_log_reader* reader, int64_t offset, void* buffer, size_t length)
+{
+    if (binary_log_seek(reader->file, reader->base + offset, SEEK_SET) != 0 ||
+        fread(buffer, 1, length, reader->file) != length)
+    {
+        return EIO;
+    }
+
+    return 0;
+}
+
+static int add_entry(struct hdr_binary_log_reader* reader, size_t* capacity, struct hdr_binary_log_entry** entry)
+{
+    if (grow_array(
+        (void**) &reader->entries, capacity, (size_t) reader->entries_len + 1,
+        sizeof(struct hdr_binary_log_entry)))
+    {
+        return ENOMEM;
+    }
+
+    *entry = &reader->entries[reader->entries_len++];
+
+    return 0;
+}
+
+/* Loads the index written when the writer was closed, returning EINVAL if */
+/* there is none or it does not match the records it points to.           */
+static int load_index(struct hdr_binary_log_reader* reader, int64_t size)
+{
+    _binary_log_trailer trailer;
+    int64_t index_offset, index_len, i;
+    int64_t position;
+    size_t entries_capacity = 0;
+    size_t tags_capacity = 0;
+    int32_t tags_len, t;
+    char* tag = NULL;
+    int rc;
+
+    if (size < (int64_t) (SIZEOF_BINARY_LOG_HEADER + SIZEOF_BINARY_LOG_TRAILER) ||
+        (rc = read_at(reader, size - (int64_t) SIZEOF_BINARY_LOG_TRAILER, &trailer, SIZEOF_BINARY_LOG_TRAILER)) != 0)
+    {
+        return EINVAL;
+    }
+
+    index_offset = be64toh(trailer.index_offset);
+    index_len = be64toh(trailer.index_len);
+    tags_len = be32toh(trailer.tags_len);
+
+    if (BINARY_LOG_TRAILER_COOKIE != (int32_t) be32toh(trailer.cookie) ||
+        index_offset < (int64_t) SIZEOF_BINARY_LOG_HEADER || index_offset > size ||
+        index_len < 0 || index_len > (size - index_offset) / (int64_t) SIZEOF_BINARY_LOG_INDEX_ENTRY ||
+        tags_len < 0)
+    {
+        return EINVAL;
+    }
+
+    /* The tags follow the index. */
+    position = index_offset + index_len * (int64_t) SIZEOF_BINARY_LOG_INDEX_ENTRY;
+    for (t = 0; t < tags_len; t++)
+    {
+        int32_t tag_len, tag_id;
+
+        if (position + (int64_t) sizeof(tag_len) > size - (int64_t) SIZEOF_BINARY_LOG_TRAILER ||
+            (rc = read_at(reader, position, &tag_len, sizeof(tag_len))) != 0)
+        {
+            FAIL_AND_CLEANUP(cleanup, rc, EINVAL);
+        }
+
+        tag_len = be32toh(tag_len);
+        position += (int64_t) sizeof(tag_len);
+        if (tag_len < 0 || tag_len > size - (int64_t) SIZEOF_BINARY_LOG_TRAILER - position)
+        {
+            FAIL_AND_CLEANUP(cleanup, rc, EINVAL);
+        }
+
+        free(tag);
+        if ((tag = (char*) malloc((size_t) tag_len + 1)) == NULL)
+        {
+            FAIL_AND_CLEANUP(cleanup, rc, ENOMEM);
+        }
+
+        if ((rc = read_at(reader, position, tag, (size_t) tag_len)) != 0 ||
+            (rc = intern_tag(&reader->tags, &reader->tags_len, &tags_capacity, tag, (size_t) tag_len, &tag_id)) != 0)
+        {
+            goto cleanup;
+        }
+
+        /* Every tag is written once, so they intern to their position. */
+        if (tag_id != t)
+        {
+            FAIL_AND_CLEANUP(cleanup, rc, EINVAL);
+        }
+
+        position += tag_len;
+    }
+
+    if (position != size - (int64_t) SIZEOF_BINARY_LOG_TRAILER)
+    {
+        FAIL_AND_CLEANUP(cleanup, rc, EINVAL);
+    }
+
+    for (i = 0; i < index_len; i++)
+    {
+        struct hdr_binary_log_index_entry index_entry;
+        struct hdr_binary_log_entry* entry;
+        int64_t tag_len;
+
+        if ((rc = read_at(
+            reader, index_offset + i * (int64_t) SIZEOF_BINARY_LOG_INDEX_ENTRY,
+            &index_entry, SIZEOF_BINARY_LOG_INDEX_ENTRY)) != 0 ||
+            (rc = add_entry(reader, &entries_capacity, &entry)) != 0)
+        {
+            goto cleanup;
+        }
+
+        entry->offset            = be64toh(index_entry.offset);
+        entry->timestamp.tv_sec  = be64toh(index_entry.timestamp_sec);
+        entry->timestamp.tv_nsec = be32toh(index_entry.timestamp_nsec);
+        entry->interval.tv_sec   = be64toh(index_entry.interval_sec);
+        entry->interval.tv_nsec  = be32toh(index_entry.interval_nsec);
+        entry->max_value         = be64toh(index_entry.max_value);
+        entry->length            = be32toh(index_entry.length);
+        index_entry.tag_id       = be32toh(index_entry.tag_id);
+
+        if (index_entry.tag_id < -1 || index_entry.tag_id >= reader->tags_len || entry->length < 0)
+        {
+            FAIL_AND_CLEANUP(cleanup, rc, EINVAL);
+        }
+
+        entry->tag = index_entry.tag_id < 0 ? NULL : reader->tags[index_entry.tag_id];
+        tag_len = NULL == entry->tag ? 0 : (int64_t) strlen(entry->tag);
+
+        if (entry->offset < (int64_t) SIZEOF_BINARY_LOG_HEADER ||
+            entry->offset > index_offset - (int64_t) SIZEOF_BINARY_LOG_RECORD - tag_len - entry->length)
+        {
+            FAIL_AND_CLEANUP(cleanup, rc, EINVAL);
+        }
+    }
+
+cleanup:
+    free(tag);
+
+    return rc;
+}
+
+/* Rebuilds the index of a log whose writer was not closed from its records, */
+/* up to the first record that is incomplete.                                */
+static int scan_records(struct hdr_binary_log_reader* reader, int64_t size)
+{
+    int64_t position = (int64_t) SIZEOF_BINARY_LOG_HEADER;
+    size_t entries_capacity = 0;
+    size_t tags_capacity = 0;
+    char* tag = NULL;
+    size_t tag_capacity = 0;
+    int rc = 0;
+
+    while (position + (int64_t) SIZEOF_BINARY_LOG_RECORD <= size)
+    {
+        _binary_log_record record;
+        struct hdr_binary_log_entry* entry;
+        int32_t tag_len, length, tag_id = -1;
+
+        if ((rc = read_at(reader, position, &record, SIZEOF_BINARY_LOG_RECORD)) != 0)
+        {
+            goto cleanup;
+        }
+
+        tag_len = be32toh(record.tag_len);
+        length = be32toh(record.length);
+
+        if (BINARY_LOG_RECORD_COOKIE != (int32_t) be32toh(record.cookie) || tag_len < 0 || length < 0 ||
+            (int64_t) tag_len + length > size - position - (int64_t) SIZEOF_BINARY_LOG_RECORD)
+        {
+            break;
+        }
+
+        if (0 < tag_len)
+        {
+            if (grow_array((void**) &tag, &tag_capacity, (size_t) tag_len, 1))
+            {
+                FAIL_AND_CLEANUP(cleanup, rc, ENOMEM);
+            }
+
+            if ((rc = read_at(reader, position + (int64_t) SIZEOF_BINARY_LOG_RECORD, tag, (size_t) tag_len)) != 0 ||
+                (rc = intern_tag(
+                    &reader->tags, &reader->tags_len, &tags_capacity, tag, (size_t) tag_len, &tag_id)) != 0)
+            {
+                goto cleanup;
+            }
+        }
+
+        if ((rc = add_entry(reader, &entries_capacity, &entry)) != 0)
+        {
+            goto cleanup;
+        }
+
+        entry->offset            = position;
+        entry->timestamp.tv_sec  = be64toh(record.timestamp_sec);
+        entry->timestamp.tv_nsec = be32toh(record.timestamp_nsec);
+        entry->interval.tv_sec   = be64toh(record.interval_sec);
+        entry->interval.tv_nsec  = be32toh(record.interval_nsec);
+        entry->max_value         = be64toh(record.max_value);
+        entry->length            = length;
+        entry->tag               = tag_id < 0 ? NULL : reader->tags[tag_id];
+
+        position += (int64_t) SIZEOF_BINARY_LOG_RECORD + tag_len + length;
+    }
+
+cleanup:
+    free(tag);
+
+    return rc;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    const struct hdr_binary_log_entry* x = (const struct hdr_binary_log_entry*) a;
+    const struct hdr_binary_log_entry* y = (const struct hdr_binary_log_entry*) b;
+
+    if (x->timestamp.tv_sec != y->timestamp.tv_sec)
+    {
+        return x->timestamp.tv_sec < y->timestamp.tv_sec ? -1 : 1;
+    }
+    if (x->timestamp.tv_nsec != y->timestamp.tv_nsec)
+    {
+        return x->timestamp.tv_nsec < y->timestamp.tv_nsec ? -1 : 1;
+    }
+
+    /* Keep entries with the same timestamp in the order they were written. */
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static void reader_clear_index(struct hdr_binary_log_reader* reader)
+{
+    free(reader->entries);
+    free_tags(reader->tags, reader->tags_len);
+
+    reader->entries = NULL;
+    reader->entries_len = 0;
+    reader->tags = NULL;
+    reader->tags_len = 0;
+}
+
+int hdr_binary_log_reader_open(struct hdr_binary_log_reader* reader, FILE* file)
+{
+    _binary_log_header header;
+    int64_t size;
+    int rc;
+
+    memset(reader, 0, sizeof(struct hdr_binary_log_reader));
+    reader->file = file;
+
+    if ((reader->base = (int64_t) binary_log_tell(file)) < 0)
+    {
+        return EIO;
+    }
+
+    if (fread(&header, SIZEOF_BINARY_LOG_HEADER, 1, file) != 1 ||
+        BINARY_LOG_COOKIE != (int32_t) be32toh(header.cookie) ||
+        BINARY_LOG_VERSION != (int32_t) be32toh(header.version))
+    {
+        return HDR_LOG_INVALID_VERSION;
+    }
+
+    reader->start_timestamp.tv_sec = be64toh(header.start_sec);
+    reader->start_timestamp.tv_nsec = be32toh(header.start_nsec);
+
+    if (binary_log_seek(file, 0, SEEK_END) != 0 || (size = (int64_t) binary_log_tell(file) - reader->base) < 0)
+    {
+        return EIO;
+    }
+
+    /* Without a usable index, rebuild it from the records. */
+    if ((rc = load_index(reader, size)) != 0)
+    {
+        reader_clear_index(reader);
+        if (ENOMEM == rc || (rc = scan_records(reader, size)) != 0)
+        {
+            reader_clear_index(reader);
+            return rc;
+        }
+    }
+
+    if (0 < reader->entries_len)
+    {
+        qsort(reader->entries, (size_t) reader->entries_len, sizeof(struct hdr_binary_log_entry), compare_entries);
+    }
+
+    return 0;
+}
+
+void hdr_binary_log_reader_close(struct hdr_binary_log_reader* reader)
+{
+    reader_clear_index(reader);
+    hdr_decoder_close(reader->decoder);
+    free(reader->buffer);
+
+    reader->decoder = NULL;
+    reader->buffer = NULL;
+    reader->buffer_capacity = 0;
+}
+
+int64_t hdr_binary_log_seek(const struct hdr_binary_log_reader* reader, const hdr_timespec* timestamp)
+{
+    int64_t low = 0;
+    int64_t high = reader->entries_len;
+
+    while (low < high)
+    {
+        int64_t mid = low + (high - low) / 2;
+        const hdr_timespec* t = &reader->entries[mid].timestamp;
+
+        if (t->tv_sec < timestamp->tv_sec || (t->tv_sec == timestamp->tv_sec && t->tv_nsec < timestamp->tv_nsec))
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+int hdr_binary_log_read_encoded(struct hdr_binary_log_reader* reader, int64_t index, const uint8_t** data)
+{
+    const struct hdr_binary_log_entry* entry;
+    int64_t tag_len;
+    int rc;
+
+    if (index < 0 || index >= reader->entries_len)
+    {
+        return EINVAL;
+    }
+
+    entry = &reader->entries[index];
+    tag_len = NULL == entry->tag ? 0 : (int64_t) strlen(entry->tag);
+
+    if (grow_array((void**) &reader->buffer, &reader->buffer_capacity, (size_t) entry->length, 1))
+    {
+        return ENOMEM;
+    }
+
+    rc = read_at(
+        reader, entry->offset + (int64_t) SIZEOF_BINARY_LOG_RECORD + tag_len, reader->buffer, (size_t) entry->length);
+    if (rc)
+    {
+        return rc;
+    }
+
+    *data = reader->buffer;
+
+    return 0;
+}
+
+int hdr_binary_log_read(
+    struct hdr_binary_log_reader* reader, int64_t index, struct hdr_histogram** histogram)
+{
+    const uint8_t* data;
+    int rc;
+
+    if ((rc = hdr_binary_log_read_encoded(reader, index, &data)) != 0)
+    {
+        return rc;
+    }
+
+    if (NULL == reader->decoder && (rc = hdr_decoder_init(&reader->decoder)) != 0)
+    {
+        return rc;
+    }
+
+    return hdr_decoder_decode(reader->decoder, data, (size_t) reader->entries[index].length, histogram);
+}
+
+/*  ######   #######  ##    ## ##     ## ######## ########  ########  */
+/* ##    ## ##     ## ###   ## ##     ## ##       ##     ##    ##     */
+/* ##       ##     ## ####  ## ##     ## ##       ##     ##    ##     */
+/* ##       ##     ## ## ## ## ##     ## ######   ########     ##     */
+/* ##       ##     ## ##  ####  ##   ##  ##       ##   ##      ##     */
+/* ##    ## ##     ## ##   ###   ## ##   ##       ##    ##     ##     */
+/*  ######   #######  ##    ##    ###    ######## ##     ##    ##     */
+
+int hdr_binary_log_from_text(const char* text_path, FILE* binary)
+{
+    struct hdr_log_mmap_reader reader;
+    struct hdr_binary_log_writer writer;
+    struct hdr_log_entry entry;
+    struct hdr_histogram* histogram = NULL;
+    uint8_t* compressed = NULL;
+    size_t compressed_capacity = 0;
+    char* tag = NULL;
+    size_t tag_capacity = 0;
+    int rc, close_rc;
+
+    if ((rc = hdr_log_mmap_reader_open(&reader, text_path)) != 0)
+    {
+        return rc;
+    }
+
+    if ((rc = hdr_binary_log_writer_init(&writer, binary, &reader.reader.start_timestamp)) != 0)
+    {
+        FAIL_AND_CLEANUP(cleanup, rc, rc);
+    }
+
+    while ((rc = hdr_log_mmap_next(&reader, &entry)) == 0)
+    {
+        size_t compressed_len = hdr_base64_decoded_len(entry.base64_len);
+
+        if (NULL != entry.tag)
+        {
+            if (grow_array((void**) &tag, &tag_capacity, entry.tag_len + 1, 1))
+            {
+                FAIL_AND_CLEANUP(close_writer, rc, ENOMEM);
+            }
+
+            memcpy(tag, entry.tag, entry.tag_len);
+            tag[entry.tag_len] = '\0';
+        }
+
+        /* Delta entries depend on the entries before them, so they are stored whole. */
+        if (reader.reader.keyframe_interval > 0)
+        {
+            if ((rc = hdr_log_mmap_decode(&reader, &entry, &histogram)) != 0)
+            {
+                goto close_writer;
+            }
+
+            rc = hdr_binary_log_write(
+                &writer, NULL == entry.tag ? NULL : tag, &entry.timestamp, &entry.interval, histogram);
+
+            hdr_close(histogram);
+            histogram = NULL;
+        }
+        else
+        {
+            if (0 == compressed_len)
+            {
+                FAIL_AND_CLEANUP(close_writer, rc, EINVAL);
+            }
+
+            if (grow_array((void**) &compressed, &compressed_capacity, compressed_len, 1))
+            {
+                FAIL_AND_CLEANUP(close_writer, rc, ENOMEM);
+            }
+
+            if ((rc = hdr_base64_decode(entry.base64, entry.base64_len, compressed, compressed_len)) != 0)
+            {
+                goto close_writer;
+            }
+
+            rc = hdr_binary_log_write_encoded(
+                &writer, NULL == entry.tag ? NULL : tag, &entry.timestamp, &entry.interval,
+                0 < entry.max_value && entry.max_value < (double) INT64_MAX ? (int64_t) ceil(entry.max_value) : 0,
+                compressed, compressed_len);
+        }
+
+        if (rc)
+        {
+            goto close_writer;
+        }
+    }
+
+    rc = EOF == rc ? 0 : rc;
+
+close_writer:
+    close_rc = hdr_binary_log_writer_close(&writer);
+    rc = 0 == rc ? close_rc : rc;
+
+cleanup:
+    hdr_log_mmap_reader_close(&reader);
+    free(compressed);
+    free(tag);
+
+    return rc;
+}
+
+int hdr_binary_log_to_text(FILE* binary, FILE* text)
+{
+    struct hdr_binary_log_reader reader;
+    struct hdr_log_writer writer;
+    char* base64 = NULL;
+    size_t base64_capacity = 0;
+    int64_t i;
+    int rc;
+
+    if ((rc = hdr_binary_log_reader_open(&reader, binary)) != 0)
+    {
+        return rc;
+    }
+
+    hdr_log_writer_init(&writer);
+    if ((rc = hdr_log_write_header(&writer, text, NULL, &reader.start_timestamp)) != 0)
+    {
+        goto cleanup;
+    }
+
+    for (i = 0; i < reader.entries_len; i++)
+    {
+        const struct hdr_binary_log_entry* entry = &reader.entries[i];
+        const uint8_t* data;
+        size_t base64_len = hdr_base64_encoded_len((size_t) entry->length);
+
+        if ((rc = hdr_binary_log_read_encoded(&reader, i, &data)) != 0)
+        {
+            goto cleanup;
+        }
+
+        if (grow_array((void**) &base64, &base64_capacity, base64_len + 1, 1))
+        {
+            FAIL_AND_CLEANUP(cleanup, rc, ENOMEM);
+        }
+
+        if ((rc = hdr_base64_encode(data, (size_t) entry->length, base64, base64_len)) != 0)
+        {
+            goto cleanup;
+        }
+        base64[base64_len] = '\0';
+
+        if ((NULL != entry->tag && fprintf(text, "Tag=%s,", entry->tag) < 0) ||
+            fprintf(
+                text, "%.3f,%.3f,%"PRId64".0,%s\n",
+                hdr_timespec_as_double(&entry->timestamp),
+                hdr_timespec_as_double(&entry->interval),
+                entry->max_value,
+                base64) < 0)
+        {
+            FAIL_AND_CLEANUP(cleanup, rc, EIO);
+        }
+    }
+
+cleanup:
+    hdr_log_writer_close(&writer);
+    hdr_binary_log_reader_close(&reader);
+    free(base64);
+
+    return rc;
+}
+
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#endif
@@ -0,0 +1,211 @@
+/**
+ * hdr_histogram_binary_log.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A binary container for interval histograms.  The file starts with a header
+ * holding the start timestamp of the log, followed by one record per interval
+ * holding its timestamps, maximum value and tag and the histogram as encoded
+ * by hdr_encode_compressed, without base64.  Closing the writer appends an
+ * index of every record, so readers can seek to a time window and skip
+ * entries by their maximum or tag without reading or decoding them.  All
+ * values are big endian.
+ */
+
+#ifndef HDR_HISTOGRAM_BINARY_LOG_H
+#define HDR_HISTOGRAM_BINARY_LOG_H 1
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hdr_time.h"
+#include "hdr_histogram.h"
+
+struct hdr_encoder;
+struct hdr_decoder;
+struct hdr_binary_log_index_entry;
+
+struct hdr_binary_log_entry
+{
+    hdr_timespec timestamp;
+    hdr_timespec interval;
+    int64_t max_value;
+    /** The tag of the entry, NULL if it has none. */
+    const char* tag;
+    /** Position of the entry's record from the start of the log. */
+    int64_t offset;
+    /** Length of the encoded histogram. */
+    int32_t length;
+};
+
+struct hdr_binary_log_writer
+{
+    FILE* file;
+    int64_t position;
+    struct hdr_encoder* encoder;
+    struct hdr_binary_log_index_entry* index;
+    int64_t index_len;
+    size_t index_capacity;
+    char** tags;
+    int32_t tags_len;
+    size_t tags_capacity;
+};
+
+struct hdr_binary_log_reader
+{
+    FILE* file;
+    int64_t base;
+    hdr_timespec start_timestamp;
+    /** Every entry of the log, in timestamp order. */
+    struct hdr_binary_log_entry* entries;
+    int64_t entries_len;
+    char** tags;
+    int32_t tags_len;
+    struct hdr_decoder* decoder;
+    uint8_t* buffer;
+    size_t buffer_capacity;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise the writer and write the log header at the current position of
+ * 'file', which must be opened in binary mode.
+ *
+ * @param writer 'This' pointer
+ * @param file The stream to write the log to.
+ * @param start_timestamp The start timestamp of the log.
+ * @return 0 on success, EIO if the header could not be written.
+ */
+int hdr_binary_log_writer_init(
+    struct hdr_binary_log_writer* writer, FILE* file, const hdr_timespec* start_timestamp);
+
+/**
+ * Encode and append a histogram to the log.
+ *
+ * @param writer 'This' pointer
+ * @param tag The tag of the entry, NULL for none.
+ * @param timestamp The start timestamp of the interval.
+ * @param interval The end timestamp of the interval.
+ * @param histogram The histogram to write.
+ * @return 0 on success, ENOMEM if a buffer could not be grown, EIO if the
+ * record could not be written, otherwise as hdr_encoder_encode.
+ */
+int hdr_binary_log_write(
+    struct hdr_binary_log_writer* writer,
+    const char* tag,
+    const hdr_timespec* timestamp,
+    const hdr_timespec* interval,
+    const struct hdr_histogram* histogram);
+
+/**
+ * Append an already encoded histogram, as produced by hdr_encode_compressed,
+ * to the log.
+ *
+ * @param writer 'This' pointer
+ * @param tag The tag of the entry, NULL for none.
+ * @param timestamp The start timestamp of the interval.
+ * @param interval The end timestamp of the interval.
+ * @param max_value The maximum value recorded in the histogram.
+ * @param data The encoded histogram.
+ * @param length The length of the encoded histogram.
+ * @return 0 on success, EINVAL if the histogram is too large, ENOMEM if a
+ * buffer could not be grown, EIO if the record could not be written.
+ */
+int hdr_binary_log_write_encoded(
+    struct hdr_binary_log_writer* writer,
+    const char* tag,
+    const hdr_timespec* timestamp,
+    const hdr_timespec* interval,
+    int64_t max_value,
+    const uint8_t* data,
+    size_t length);
+
+/**
+ * Append the index to the log and free the writer's buffers.  The stream is
+ * left open.  A log whose writer was never closed has no index, readers then
+ * rebuild it by scanning the records.
+ *
+ * @param writer 'This' pointer
+ * @return 0 on success, EIO if the index could not be written.
+ */
+int hdr_binary_log_writer_close(struct hdr_binary_log_writer* writer);
+
+/**
+ * Open the log starting at the current position of 'file' and load its index.
+ *
+ * @param reader 'This' pointer
+ * @param file The stream to read the log from, opened in binary mode.
+ * @return 0 on success, HDR_LOG_INVALID_VERSION if the stream does not hold a
+ * binary log, EINVAL if the index or a record is corrupt, ENOMEM if the index
+ * could not be allocated, EIO if the stream could not be read.
+ */
+int hdr_binary_log_reader_open(struct hdr_binary_log_reader* reader, FILE* file);
+
+/**
+ * Free the index and buffers held by the reader.  The stream is left open.
+ *
+ * @param reader 'This' pointer
+ */
+void hdr_binary_log_reader_close(struct hdr_binary_log_reader* reader);
+
+/**
+ * Find the first entry that starts at or after the given timestamp.
+ *
+ * @param reader 'This' pointer
+ * @param timestamp The start of the time window.
+ * @return The index of the entry in reader->entries, entries_len if every
+ * entry starts before the timestamp.
+ */
+int64_t hdr_binary_log_seek(const struct hdr_binary_log_reader* reader, const hdr_timespec* timestamp);
+
+/**
+ * Read an encoded histogram into a buffer owned by the reader, valid until
+ * the next read.
+ *
+ * @param reader 'This' pointer
+ * @param index The index of the entry in reader->entries.
+ * @param data Output parameter to capture the encoded histogram, whose length
+ * is the length of the entry.
+ * @return 0 on success, EINVAL if the index is out of range, ENOMEM if the
+ * buffer could not be grown, EIO if the stream could not be read.
+ */
+int hdr_binary_log_read_encoded(struct hdr_binary_log_reader* reader, int64_t index, const uint8_t** data);
+
+/**
+ * Read and decode the histogram of an entry, as hdr_log_read.
+ *
+ * @param reader 'This' pointer
+ * @param index The index of the entry in reader->entries.
+ * @param histogram Pointer to allocate a histogram to or merge into.
+ * @return As hdr_binary_log_read_encoded and hdr_decoder_decode.
+ */
+int hdr_binary_log_read(
+    struct hdr_binary_log_reader* reader, int64_t index, struct hdr_histogram** histogram);
+
+/**
+ * Convert a text interval log, delta encoded or not, into a binary log.
+ *
+ * @param text_path The text log to convert.
+ * @param binary The stream to write the binary log to.
+ * @return 0 on success, otherwise the error of the failed read or write.
+ */
+int hdr_binary_log_from_text(const char* text_path, FILE* binary);
+
+/**
+ * Convert a binary log into a text interval log, with entries in timestamp
+ * order.
+ *
+ * @param binary The stream to read the binary log from.
+ * @param text The stream to write the text log to.
+ * @return 0 on success, otherwise the error of the failed read or write.
+ */
+int hdr_binary_log_to_text(FILE* binary, FILE* text);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,6 +16,7 @@
 #include <zlib.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <time.h>
 
@@ -23,6 +24,7 @@
 #include "hdr_histogram.h"
 #include "hdr_histogram_log.h"
 #include "hdr_tests.h"
+#include "hdr_thread.h"
 
 #if defined(_MSC_VER)
 #include <intsafe.h>
@@ -34,6 +36,23 @@ typedef SSIZE_T ssize_t;
 
 #include "hdr_endian.h"
 
+#if defined(_WIN32) || defined(_WIN64)
+
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <windows.h>
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#endif
+
 /* Private prototypes useful for the logger */
 int32_t counts_index_for(const struct hdr_histogram* h, int64_t value);
 
@@ -46,30 +65,6 @@ int32_t counts_index_for(const struct hdr_histogram* h, int64_t value);
     }                       \
     while (0)
 
-static int realloc_buffer(
-    void** buffer, size_t nmemb, ssize_t size)
-{
-    size_t len = nmemb * size;
-    if (NULL == *buffer)
-    {
-        *buffer = malloc(len);
-    }
-    else
-    {
-        *buffer = realloc(*buffer, len);
-    }
-
-    if (NULL == *buffer)
-    {
-        return ENOMEM;
-    }
-    else
-    {
-        memset(*buffer, 0, len);
-        return 0;
-    }
-}
-
 /*  ######  ######## ########  #### ##    ##  ######    ######  */
 /* ##    ##    ##    ##     ##  ##  ###   ## ##    ##  ##    ## */
 /* ##          ##    ##     ##  ##  ####  ## ##        ##       */
@@ -96,6 +91,114 @@ static ssize_t null_trailing_whitespace(char* s, ssize_t len)
     return 0;
 }
 
+static bool is_digit(char c)
+{
+    return (unsigned) (c - '0') < 10;
+}
+
+/* The parsers below work on spans of a line that need not be NUL terminated, */
+/* such as lines of a memory mapped log, and never read at or past end.       */
+
+/* Advances past prefix if the span at cursor starts with it. */
+static bool match_prefix(const char** cursor, const char* end, const char* prefix)
+{
+    size_t len = strlen(prefix);
+
+    if ((size_t) (end - *cursor) < len || memcmp(*cursor, prefix, len) != 0)
+    {
+        return false;
+    }
+
+    *cursor += len;
+
+    return true;
+}
+
+#define NUMBER_TOKEN_LEN 64
+
+/* Copies the start of the span into a NUL terminated token for strtol and strtod. */
+static void copy_number_token(char* token, const char* cursor, const char* end)
+{
+    size_t len = (size_t) (end - cursor) < NUMBER_TOKEN_LEN - 1 ? (size_t) (end - cursor) : NUMBER_TOKEN_LEN - 1;
+
+    memcpy(token, cursor, len);
+    token[len] = '\0';
+}
+
+static bool parse_int(const char** cursor, const char* end, int* value)
+{
+    char token[NUMBER_TOKEN_LEN];
+    char* token_end;
+    long parsed;
+
+    copy_number_token(token, *cursor, end);
+    parsed = strtol(token, &token_end, 10);
+
+    if (token_end == token || parsed < INT_MIN || INT_MAX < parsed)
+    {
+        return false;
+    }
+
+    *value = (int) parsed;
+    *cursor += token_end - token;
+
+    return true;
+}
+
+static const double powers_of_ten[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+        1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+    };
+
+/* Parses a number as strtod does, advancing past it.  The fixed point numbers */
+/* log writers produce take a fast path: up to 15 digits and the power of ten  */
+/* scaling them are exact doubles, so a single division rounds them exactly as */
+/* strtod would.  Anything else, exponents included, is left to strtod.        */
+static bool parse_double(const char** cursor, const char* end, double* value)
+{
+    const char* p = *cursor;
+    bool negative = p < end && '-' == *p;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fraction_digits = 0;
+    char token[NUMBER_TOKEN_LEN];
+    char* token_end;
+
+    p += negative;
+
+    for (; p < end && is_digit(*p) && digits <= 15; p++, digits++)
+    {
+        mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+    }
+
+    if (p < end && '.' == *p)
+    {
+        for (p++; p < end && is_digit(*p) && digits <= 15; p++, digits++, fraction_digits++)
+        {
+            mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+        }
+    }
+
+    if (0 < digits && digits <= 15 && (p == end || NULL == strchr("0123456789.eEpPxX", *p)))
+    {
+        *value = (negative ? -1.0 : 1.0) * ((double) mantissa / powers_of_ten[fraction_digits]);
+        *cursor = p;
+        return true;
+    }
+
+    copy_number_token(token, *cursor, end);
+    *value = strtod(token, &token_end);
+    if (token_end == token)
+    {
+        return false;
+    }
+
+    *cursor += token_end - token;
+
+    return true;
+}
+
 /* ######## ##    ##  ######   #######  ########  #### ##    ##  ######   */
 /* ##       ###   ## ##    ## ##     ## ##     ##  ##  ###   ## ##    ##  */
 /* ##       ####  ## ##       ##     ## ##     ##  ##  ####  ## ##        */
@@ -113,6 +216,15 @@ static const int32_t V1_COMPRESSION_COOKIE = 0x1c849302;
 static const int32_t V2_ENCODING_COOKIE = 0x1c849303;
 static const int32_t V2_COMPRESSION_COOKIE = 0x1c849304;
 
+/* Encodings framed like V2_COMPRESSION_COOKIE, but stored without compression. */
+static const int32_t STORED_COMPRESSION_COOKIE = 0x1c849306;
+
+/* V2 encoded differences from the previous interval of a delta encoded log. */
+static const int32_t DELTA_ENCODING_COOKIE = 0x1c849307;
+
+/* Packed counts, see packed_encode_counts, in the V2 compression framing. */
+static const int32_t V3_ENCODING_COOKIE = 0x1c849305;
+
 static int32_t get_cookie_base(int32_t cookie)
 {
     return (cookie & ~0xf0);
@@ -147,6 +259,8 @@ const char* hdr_strerror(int errnum)
             return "Truncated value found when decoding";
         case HDR_ENCODED_INPUT_TOO_LONG:
             return "The encoded input exceeds the size of the histogram";
+        case HDR_LOG_DELTA_WITHOUT_KEYFRAME:
+            return "Delta encoded histogram without a preceding keyframe";
         default:
             return strerror(errnum);
     }
@@ -206,6 +320,21 @@ typedef struct /*__attribute__((__packed__))*/
     uint8_t counts[1];
 } _encoding_flyweight_v1;
 
+/* V1 with the total count and maximum, for peeking at the header. */
+typedef struct /*__attribute__((__packed__))*/
+{
+    int32_t cookie;
+    int32_t payload_len;
+    int32_t normalizing_index_offset;
+    int32_t significant_figures;
+    int64_t lowest_trackable_value;
+    int64_t highest_trackable_value;
+    uint64_t conversion_ratio_bits;
+    int64_t total_count;
+    int64_t max_value;
+    uint8_t counts[1];
+} _encoding_flyweight_v3;
+
 typedef struct /*__attribute__((__packed__))*/
 {
     int32_t cookie;
@@ -216,969 +345,2897 @@ typedef struct /*__attribute__((__packed__))*/
 
 #define SIZEOF_ENCODING_FLYWEIGHT_V0 (sizeof(_encoding_flyweight_v0) - sizeof(int64_t))
 #define SIZEOF_ENCODING_FLYWEIGHT_V1 (sizeof(_encoding_flyweight_v1) - sizeof(uint8_t))
+#define SIZEOF_ENCODING_FLYWEIGHT_V3 (sizeof(_encoding_flyweight_v3) - sizeof(uint8_t))
 #define SIZEOF_COMPRESSION_FLYWEIGHT (sizeof(_compression_flyweight) - sizeof(uint8_t))
 
-int hdr_encode_compressed(
-    struct hdr_histogram* h,
-    uint8_t** compressed_histogram,
-    size_t* compressed_len)
+/* Counts are varint encoded into a 4KB chunk, which is handed to deflate */
+/* whenever it can not take another batch of counts, at most 9 bytes each. */
+#define ENCODER_CHUNK_LEN 4096
+#define ENCODER_MIN_BATCH_COUNTS 32
+#define ENCODER_DELTA_BATCH (ENCODER_CHUNK_LEN / MAX_BYTES_LEB128)
+
+struct hdr_encoder
 {
-    _encoding_flyweight_v1* encoded = NULL;
-    _compression_flyweight* compressed = NULL;
-    int i;
-    int result = 0;
-    int data_index = 0;
-    int32_t payload_len;
-    uLong encoded_size;
-    uLongf dest_len;
-    size_t compressed_size;
+    z_stream strm;
+    int codec;
+    int32_t version;
+    uint8_t* packed;
+    size_t packed_capacity;
+    _compression_flyweight* compressed;
+    size_t compressed_capacity;
+    uint8_t chunk[ENCODER_CHUNK_LEN];
+    int64_t deltas[ENCODER_DELTA_BATCH];
+};
 
-    int32_t len_to_max = counts_index_for(h, h->max_value) + 1;
-    int32_t counts_limit = len_to_max < h->counts_len ? len_to_max : h->counts_len;
+/* Grows a scratch buffer owned by an encoder or decoder, keeping its contents. */
+static int ensure_capacity(void** buffer, size_t* capacity, size_t len)
+{
+    void* grown;
 
-    const size_t encoded_len = SIZEOF_ENCODING_FLYWEIGHT_V1 + MAX_BYTES_LEB128 * (size_t) counts_limit;
-    if ((encoded = (_encoding_flyweight_v1*) calloc(encoded_len, sizeof(uint8_t))) == NULL)
+    if (len <= *capacity)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        return 0;
     }
 
-    for (i = 0; i < counts_limit;)
+    if ((grown = realloc(*buffer, len)) == NULL)
     {
-        int64_t value = h->counts[i];
-        i++;
+        return ENOMEM;
+    }
 
-        if (value == 0)
-        {
-            int32_t zeros = 1;
+    *buffer = grown;
+    *capacity = len;
 
-            while (i < counts_limit && 0 == h->counts[i])
-            {
-                zeros++;
-                i++;
-            }
+    return 0;
+}
 
-            data_index += zig_zag_encode_i64(&encoded->counts[data_index], -zeros);
-        }
-        else
-        {
-            data_index += zig_zag_encode_i64(&encoded->counts[data_index], value);
-        }
+int hdr_encoder_init(struct hdr_encoder** encoder)
+{
+    struct hdr_encoder* e = (struct hdr_encoder*) calloc(1, sizeof(struct hdr_encoder));
+    if (!e)
+    {
+        return ENOMEM;
     }
 
-    payload_len = data_index;
-    encoded_size = SIZEOF_ENCODING_FLYWEIGHT_V1 + data_index;
+    strm_init(&e->strm);
+    if (deflateInit(&e->strm, Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        free(e);
+        return HDR_DEFLATE_INIT_FAIL;
+    }
 
-    encoded->cookie                   = htobe32(V2_ENCODING_COOKIE | 0x10);
-    encoded->payload_len              = htobe32(payload_len);
-    encoded->normalizing_index_offset = htobe32(h->normalizing_index_offset);
-    encoded->significant_figures      = htobe32(h->significant_figures);
-    encoded->lowest_trackable_value   = htobe64(h->lowest_trackable_value);
-    encoded->highest_trackable_value  = htobe64(h->highest_trackable_value);
-    encoded->conversion_ratio_bits    = htobe64(double_to_int64_bits(h->conversion_ratio));
+    e->version = 2;
 
+    *encoder = e;
 
-    /* Estimate the size of the compressed histogram. */
-    dest_len = compressBound(encoded_size);
-    compressed_size = SIZEOF_COMPRESSION_FLYWEIGHT + dest_len;
+    return 0;
+}
 
-    if ((compressed = (_compression_flyweight*) malloc(compressed_size)) == NULL)
+int hdr_encoder_set_codec(struct hdr_encoder* encoder, int codec, int level)
+{
+    if (HDR_CODEC_DEFLATE != codec && HDR_CODEC_STORED != codec)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        return EINVAL;
     }
 
-    if (Z_OK != compress(compressed->data, &dest_len, (Bytef*) encoded, encoded_size))
+    if (HDR_CODEC_DEFLATE == codec)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_DEFLATE_FAIL);
-    }
-
-    compressed->cookie = htobe32(V2_COMPRESSION_COOKIE | 0x10);
-    compressed->length = htobe32((int32_t)dest_len);
-
-    *compressed_histogram = (uint8_t*) compressed;
-    *compressed_len = SIZEOF_COMPRESSION_FLYWEIGHT + dest_len;
+        if (level < Z_DEFAULT_COMPRESSION || Z_BEST_COMPRESSION < level)
+        {
+            return EINVAL;
+        }
 
-    cleanup:
-    free(encoded);
-    if (result == HDR_DEFLATE_FAIL)
-    {
-        free(compressed);
+        /* Changing the level of a freshly reset stream never has output to flush. */
+        if (deflateReset(&encoder->strm) != Z_OK ||
+            deflateParams(&encoder->strm, level, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return HDR_DEFLATE_FAIL;
+        }
     }
 
-    return result;
-}
+    encoder->codec = codec;
 
-/* ########  ########  ######   #######  ########  #### ##    ##  ######   */
-/* ##     ## ##       ##    ## ##     ## ##     ##  ##  ###   ## ##    ##  */
-/* ##     ## ##       ##       ##     ## ##     ##  ##  ####  ## ##        */
-/* ##     ## ######   ##       ##     ## ##     ##  ##  ## ## ## ##   #### */
-/* ##     ## ##       ##       ##     ## ##     ##  ##  ##  #### ##    ##  */
-/* ##     ## ##       ##    ## ##     ## ##     ##  ##  ##   ### ##    ##  */
-/* ########  ########  ######   #######  ########  #### ##    ##  ######   */
+    return 0;
+}
 
-static void _apply_to_counts_16(struct hdr_histogram* h, const int16_t* counts_data, const int32_t counts_limit)
+int hdr_encoder_set_version(struct hdr_encoder* encoder, int32_t version)
 {
-    int i;
-    for (i = 0; i < counts_limit; i++)
+    if (2 != version && 3 != version)
     {
-        h->counts[i] = be16toh(counts_data[i]);
+        return EINVAL;
     }
+
+    encoder->version = version;
+
+    return 0;
 }
 
-static void _apply_to_counts_32(struct hdr_histogram* h, const int32_t* counts_data, const int32_t counts_limit)
+void hdr_encoder_close(struct hdr_encoder* encoder)
 {
-    int i;
-    for (i = 0; i < counts_limit; i++)
+    if (!encoder)
     {
-        h->counts[i] = be32toh(counts_data[i]);
+        return;
     }
+
+    (void)deflateEnd(&encoder->strm);
+    free(encoder->compressed);
+    free(encoder->packed);
+    free(encoder);
 }
 
-static void _apply_to_counts_64(struct hdr_histogram* h, const int64_t* counts_data, const int32_t counts_limit)
+static int32_t encoded_counts_limit(const struct hdr_histogram* h)
 {
-    int i;
-    for (i = 0; i < counts_limit; i++)
-    {
-        h->counts[i] = be64toh(counts_data[i]);
-    }
+    int32_t len_to_max = counts_index_for(h, h->max_value) + 1;
+    return len_to_max < h->counts_len ? len_to_max : h->counts_len;
 }
 
-static int _apply_to_counts_zz(struct hdr_histogram* h, const uint8_t* counts_data, const int32_t data_limit)
+static size_t encode_bound(int32_t counts_limit)
 {
-    int64_t data_index = 0;
-    int32_t counts_index = 0;
-    int64_t value;
+    /* The packed V3 counts need a little more room than V2's varints. */
+    uLong encoded_len = (uLong) (SIZEOF_ENCODING_FLYWEIGHT_V3 + packed_encoded_counts_bound(counts_limit));
 
-    while (data_index < data_limit && counts_index < h->counts_len)
-    {
-        data_index += zig_zag_decode_i64(&counts_data[data_index], &value);
+    /* compressBound covers deflate at any level, and is larger than the stored payload. */
+    return SIZEOF_COMPRESSION_FLYWEIGHT + compressBound(encoded_len);
+}
 
-        if (value < 0)
-        {
-            int64_t zeros = -value;
+size_t hdr_encode_compressed_bound(const struct hdr_histogram* h)
+{
+    return encode_bound(encoded_counts_limit(h));
+}
 
-            if (value <= INT32_MIN || counts_index + zeros > h->counts_len)
-            {
-                return HDR_TRAILING_ZEROS_INVALID;
-            }
+size_t hdr_log_encode_bound(const struct hdr_histogram* h)
+{
+    return hdr_base64_encoded_len(hdr_encode_compressed_bound(h)) + 1;
+}
 
-            counts_index += (int32_t) zeros;
-        }
-        else
-        {
-            h->counts[counts_index] = value;
-            counts_index++;
-        }
-    }
+/* Index into the counts array of a logical counts index, the counts of shifted */
+/* histograms wrap around the end of the array.                                 */
+static int32_t raw_counts_index(const struct hdr_histogram* h, int32_t index)
+{
+    int32_t raw_index = index - h->normalizing_index_offset;
 
-    if (data_index > data_limit)
+    if (raw_index < 0)
     {
-        return HDR_VALUE_TRUNCATED;
+        raw_index += h->counts_len;
     }
-    else if (data_index < data_limit)
+    else if (raw_index >= h->counts_len)
     {
-        return HDR_ENCODED_INPUT_TOO_LONG;
+        raw_index -= h->counts_len;
     }
 
-    return 0;
+    return raw_index;
 }
 
-static int _apply_to_counts(
-    struct hdr_histogram* h, const int32_t word_size, const uint8_t* counts_data, const int32_t counts_limit)
+/* Feeds the next piece of the encoded histogram to the codec, failing if the */
+/* output buffer fills up before all of it has been consumed.                 */
+static int encoder_write(struct hdr_encoder* encoder, const uint8_t* data, size_t len, int flush)
 {
-    switch (word_size)
+    int rc;
+
+    if (HDR_CODEC_STORED == encoder->codec)
     {
-        case 2:
-            _apply_to_counts_16(h, (const int16_t*) counts_data, counts_limit);
-            return 0;
+        if (len > encoder->strm.avail_out)
+        {
+            return ENOBUFS;
+        }
 
-        case 4:
-            _apply_to_counts_32(h, (const int32_t*) counts_data, counts_limit);
-            return 0;
+        memcpy(encoder->strm.next_out, data, len);
+        encoder->strm.next_out += len;
+        encoder->strm.avail_out -= (uInt) len;
+        encoder->strm.total_out += (uLong) len;
 
-        case 8:
-            _apply_to_counts_64(h, (const int64_t*) counts_data, counts_limit);
-            return 0;
+        return 0;
+    }
 
-        case 1:
-            return _apply_to_counts_zz(h, counts_data, counts_limit);
+    if (0 == len && Z_FINISH != flush)
+    {
+        return 0;
+    }
 
-        default:
-            return -1;
+    encoder->strm.next_in = (Bytef*) data;
+    encoder->strm.avail_in = (uInt) len;
+
+    rc = deflate(&encoder->strm, flush);
+
+    if (Z_FINISH == flush && Z_STREAM_END == rc)
+    {
+        return 0;
     }
+    else if (Z_FINISH != flush && Z_OK == rc && 0 == encoder->strm.avail_in)
+    {
+        return 0;
+    }
+
+    return (Z_OK == rc || Z_BUF_ERROR == rc) ? ENOBUFS : HDR_DEFLATE_FAIL;
 }
 
-static int hdr_decode_compressed_v0(
-    _compression_flyweight* compression_flyweight,
-    size_t length,
-    struct hdr_histogram** histogram)
+/* ZigZag maps the differences between intervals onto the non negative counts */
+/* the V2 counts encoding expects, leaving unchanged counts as runs of zeros.  */
+static void delta_counts(int64_t* deltas, const int64_t* counts, const int64_t* previous, int32_t len)
 {
-    struct hdr_histogram* h = NULL;
-    int result = 0;
-    uint8_t* counts_array = NULL;
-    _encoding_flyweight_v0 encoding_flyweight;
-    z_stream strm;
-    int32_t compressed_len, encoding_cookie, word_size, significant_figures, counts_array_len;
-    int64_t lowest_trackable_value, highest_trackable_value;
+    int32_t i;
 
-    strm_init(&strm);
-    if (inflateInit(&strm) != Z_OK)
+    for (i = 0; i < len; i++)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        int64_t delta = counts[i] - previous[i];
+        deltas[i] = (int64_t) (((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
     }
+}
 
-    compressed_len = be32toh(compression_flyweight->length);
+/* Encodes the counts of h, or their differences from the logical order counts */
+/* of previous when it is not NULL.                                            */
+static int encoder_encode_into(
+    struct hdr_encoder* encoder,
+    const struct hdr_histogram* h,
+    const int64_t* previous,
+    int32_t previous_counts_limit,
+    uint8_t* buffer,
+    size_t capacity,
+    size_t* compressed_len)
+{
+    _encoding_flyweight_v3 encoded;
+    _compression_flyweight* compressed = (_compression_flyweight*) buffer;
+    int32_t counts_limit = encoded_counts_limit(h);
+    int32_t raw_from = raw_counts_index(h, 0);
+    /* Logical counts order is at most two runs of the counts array. */
+    int32_t run_from[2], run_len[2], run_index[2];
+    int64_t payload_len = 0;
+    int64_t zero_run = 0;
+    size_t chunk_len = 0;
+    size_t header_len = SIZEOF_ENCODING_FLYWEIGHT_V1;
+    bool packed = NULL == previous && 3 == encoder->version;
+    int runs, r, rc;
 
-    if (compressed_len < 0 || (length - SIZEOF_COMPRESSION_FLYWEIGHT) < (size_t)compressed_len)
+    if (capacity <= SIZEOF_COMPRESSION_FLYWEIGHT)
     {
-        FAIL_AND_CLEANUP(cleanup, result, EINVAL);
+        return ENOBUFS;
     }
 
-    strm.next_in = compression_flyweight->data;
-    strm.avail_in = (uInt) compressed_len;
-    strm.next_out = (uint8_t *) &encoding_flyweight;
-    strm.avail_out = SIZEOF_ENCODING_FLYWEIGHT_V0;
-
-    if (inflate(&strm, Z_SYNC_FLUSH) != Z_OK)
+    /* Counts that have dropped back to zero still have a difference to encode. */
+    if (NULL != previous && previous_counts_limit > counts_limit)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        counts_limit = previous_counts_limit;
     }
 
-    encoding_cookie = get_cookie_base(be32toh(encoding_flyweight.cookie));
-    if (V0_ENCODING_COOKIE != encoding_cookie)
+    run_from[0] = raw_from;
+    run_index[0] = 0;
+    if (raw_from + counts_limit <= h->counts_len)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_ENCODING_COOKIE_MISMATCH);
+        run_len[0] = counts_limit;
+        runs = 1;
     }
-
-    word_size = word_size_from_cookie(be32toh(encoding_flyweight.cookie));
-    lowest_trackable_value = be64toh(encoding_flyweight.lowest_trackable_value);
-    highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
-    significant_figures = be32toh(encoding_flyweight.significant_figures);
-
-    if (hdr_init(
-        lowest_trackable_value,
-        highest_trackable_value,
-        significant_figures,
-        &h) != 0)
+    else
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        run_len[0] = h->counts_len - raw_from;
+        run_from[1] = 0;
+        run_len[1] = counts_limit - run_len[0];
+        run_index[1] = run_len[0];
+        runs = 2;
     }
 
-    counts_array_len = h->counts_len * word_size;
-    if ((counts_array = calloc(1, (size_t) counts_array_len)) == NULL)
+    /* V3 packs the whole payload up front, it is no larger than the counts. */
+    if (packed)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
-    }
+        int64_t bound = packed_encoded_counts_bound(counts_limit);
+
+        if (bound > INT32_MAX)
+        {
+            return EINVAL;
+        }
+        if (ensure_capacity((void**) &encoder->packed, &encoder->packed_capacity, (size_t) bound))
+        {
+            return ENOMEM;
+        }
 
-    strm.next_out = counts_array;
-    strm.avail_out = (uInt) counts_array_len;
+        for (r = 0; r < runs; r++)
+        {
+            payload_len += packed_encode_counts(
+                &encoder->packed[payload_len], &h->counts[run_from[r]], run_len[r]);
+        }
 
-    if (inflate(&strm, Z_FINISH) != Z_STREAM_END)
-    {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        header_len = SIZEOF_ENCODING_FLYWEIGHT_V3;
+        runs = 0;
     }
 
-    _apply_to_counts(h, word_size, counts_array, h->counts_len);
+    /* The payload length comes before the payload, so size it up front. */
+    for (r = 0; r < runs; r++)
+    {
+        const int64_t* counts = &h->counts[run_from[r]];
+        int32_t i, batch;
 
-    hdr_reset_internal_counters(h);
-    h->normalizing_index_offset = 0;
-    h->conversion_ratio = 1.0;
+        if (NULL == previous)
+        {
+            payload_len += zig_zag_encoded_counts_len(counts, run_len[r], &zero_run);
+            continue;
+        }
 
-cleanup:
-    (void)inflateEnd(&strm);
-    free(counts_array);
+        for (i = 0; i < run_len[r]; i += batch)
+        {
+            batch = run_len[r] - i < ENCODER_DELTA_BATCH ? run_len[r] - i : ENCODER_DELTA_BATCH;
+            delta_counts(encoder->deltas, &counts[i], &previous[run_index[r] + i], batch);
+            payload_len += zig_zag_encoded_counts_len(encoder->deltas, batch, &zero_run);
+        }
+    }
+    if (0 != zero_run)
+    {
+        payload_len += zig_zag_encode_i64(encoder->chunk, -zero_run);
+    }
 
-    if (result != 0)
+    if (payload_len > INT32_MAX)
     {
-        free(h);
+        return EINVAL;
     }
-    else if (NULL == *histogram)
+
+    if (packed)
     {
-        *histogram = h;
+        encoded.cookie               = htobe32(V3_ENCODING_COOKIE | 0x10);
     }
     else
     {
-        hdr_add(*histogram, h);
-        free(h);
+        encoded.cookie               = htobe32((NULL == previous ? V2_ENCODING_COOKIE : DELTA_ENCODING_COOKIE) | 0x10);
     }
+    encoded.payload_len              = htobe32((int32_t) payload_len);
+    encoded.normalizing_index_offset = htobe32(0);
+    encoded.significant_figures      = htobe32(h->significant_figures);
+    encoded.lowest_trackable_value   = htobe64(h->lowest_trackable_value);
+    encoded.highest_trackable_value  = htobe64(h->highest_trackable_value);
+    encoded.conversion_ratio_bits    = htobe64(double_to_int64_bits(h->conversion_ratio));
+    encoded.total_count              = htobe64(h->total_count);
+    encoded.max_value                = htobe64(hdr_max(h));
 
-    return result;
-}
-
-static int hdr_decode_compressed_v1(
-    _compression_flyweight* compression_flyweight,
-    size_t length,
-    struct hdr_histogram** histogram)
-{
-    struct hdr_histogram* h = NULL;
-    int result = 0;
-    uint8_t* counts_array = NULL;
-    _encoding_flyweight_v1 encoding_flyweight;
-    z_stream strm;
-    int32_t compressed_length, word_size, significant_figures, counts_limit, encoding_cookie, counts_array_len;
-    int64_t lowest_trackable_value, highest_trackable_value;
-
-    strm_init(&strm);
-    if (inflateInit(&strm) != Z_OK)
+    /* Stored output is tracked in the stream's output fields as well.  Otherwise */
+    /* reuse the deflate state, resetting it is far cheaper than initialising it. */
+    if (HDR_CODEC_STORED == encoder->codec)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        encoder->strm.total_out = 0;
     }
-
-    compressed_length = be32toh(compression_flyweight->length);
-
-    if (compressed_length < 0 || length - SIZEOF_COMPRESSION_FLYWEIGHT < (size_t)compressed_length)
+    else if (deflateReset(&encoder->strm) != Z_OK)
     {
-        FAIL_AND_CLEANUP(cleanup, result, EINVAL);
+        return HDR_DEFLATE_FAIL;
     }
 
-    strm.next_in = compression_flyweight->data;
-    strm.avail_in = (uInt) compressed_length;
-    strm.next_out = (uint8_t *) &encoding_flyweight;
-    strm.avail_out = SIZEOF_ENCODING_FLYWEIGHT_V1;
+    encoder->strm.next_out = compressed->data;
+    encoder->strm.avail_out = (uInt) (capacity - SIZEOF_COMPRESSION_FLYWEIGHT);
 
-    if (inflate(&strm, Z_SYNC_FLUSH) != Z_OK)
-    {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
-    }
+    memcpy(encoder->chunk, &encoded, header_len);
+    chunk_len = header_len;
 
-    encoding_cookie = get_cookie_base(be32toh(encoding_flyweight.cookie));
-    if (V1_ENCODING_COOKIE != encoding_cookie)
+    zero_run = 0;
+    for (r = 0; r < runs; r++)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_ENCODING_COOKIE_MISMATCH);
-    }
+        const int64_t* counts = &h->counts[run_from[r]];
+        int32_t i = 0;
 
-    word_size = word_size_from_cookie(be32toh(encoding_flyweight.cookie));
-    counts_limit = be32toh(encoding_flyweight.payload_len) / word_size;
-    lowest_trackable_value = be64toh(encoding_flyweight.lowest_trackable_value);
-    highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
-    significant_figures = be32toh(encoding_flyweight.significant_figures);
+        while (i < run_len[r])
+        {
+            int32_t batch = (int32_t) ((ENCODER_CHUNK_LEN - chunk_len) / MAX_BYTES_LEB128) - 1;
 
-    if (hdr_init(
-        lowest_trackable_value,
-        highest_trackable_value,
-        significant_figures,
-        &h) != 0)
+            if (batch < ENCODER_MIN_BATCH_COUNTS)
+            {
+                if ((rc = encoder_write(encoder, encoder->chunk, chunk_len, Z_NO_FLUSH)) != 0)
+                {
+                    return rc;
+                }
+
+                chunk_len = 0;
+                continue;
+            }
+
+            batch = run_len[r] - i < batch ? run_len[r] - i : batch;
+
+            if (NULL == previous)
+            {
+                chunk_len += (size_t) zig_zag_encode_counts(&encoder->chunk[chunk_len], &counts[i], batch, &zero_run);
+            }
+            else
+            {
+                batch = batch < ENCODER_DELTA_BATCH ? batch : ENCODER_DELTA_BATCH;
+                delta_counts(encoder->deltas, &counts[i], &previous[run_index[r] + i], batch);
+                chunk_len += (size_t) zig_zag_encode_counts(
+                    &encoder->chunk[chunk_len], encoder->deltas, batch, &zero_run);
+            }
+
+            i += batch;
+        }
+    }
+
+    /* There is always room left for the trailing zero run. */
+    if (0 != zero_run)
+    {
+        chunk_len += (size_t) zig_zag_encode_i64(&encoder->chunk[chunk_len], -zero_run);
+    }
+
+    if (packed)
+    {
+        if ((rc = encoder_write(encoder, encoder->chunk, chunk_len, Z_NO_FLUSH)) != 0 ||
+            (rc = encoder_write(encoder, encoder->packed, (size_t) payload_len, Z_FINISH)) != 0)
+        {
+            return rc;
+        }
+    }
+    else if ((rc = encoder_write(encoder, encoder->chunk, chunk_len, Z_FINISH)) != 0)
+    {
+        return rc;
+    }
+
+    compressed->cookie = htobe32(
+        (HDR_CODEC_STORED == encoder->codec ? STORED_COMPRESSION_COOKIE : V2_COMPRESSION_COOKIE) | 0x10);
+    compressed->length = htobe32((int32_t) encoder->strm.total_out);
+
+    *compressed_len = SIZEOF_COMPRESSION_FLYWEIGHT + encoder->strm.total_out;
+
+    return 0;
+}
+
+int hdr_encoder_encode_into(
+    struct hdr_encoder* encoder,
+    const struct hdr_histogram* h,
+    uint8_t* buffer,
+    size_t capacity,
+    size_t* compressed_len)
+{
+    return encoder_encode_into(encoder, h, NULL, 0, buffer, capacity, compressed_len);
+}
+
+int hdr_encoder_encode(
+    struct hdr_encoder* encoder,
+    const struct hdr_histogram* h,
+    const uint8_t** compressed_histogram,
+    size_t* compressed_len)
+{
+    size_t bound = hdr_encode_compressed_bound(h);
+    int rc;
+
+    if (ensure_capacity((void**) &encoder->compressed, &encoder->compressed_capacity, bound))
+    {
+        return ENOMEM;
+    }
+
+    rc = hdr_encoder_encode_into(encoder, h, (uint8_t*) encoder->compressed, bound, compressed_len);
+    if (0 == rc)
+    {
+        *compressed_histogram = (const uint8_t*) encoder->compressed;
+    }
+
+    return rc;
+}
+
+int hdr_encoder_encode_base64_into(
+    struct hdr_encoder* encoder,
+    const struct hdr_histogram* h,
+    char* buffer,
+    size_t capacity,
+    size_t* encoded_len)
+{
+    const uint8_t* compressed;
+    size_t compressed_len, len;
+    int rc;
+
+    if ((rc = hdr_encoder_encode(encoder, h, &compressed, &compressed_len)) != 0)
+    {
+        return rc;
+    }
+
+    len = hdr_base64_encoded_len(compressed_len);
+    if (capacity < len + 1)
+    {
+        return ENOBUFS;
+    }
+
+    if ((rc = hdr_base64_encode(compressed, compressed_len, buffer, len)) != 0)
+    {
+        return rc;
+    }
+
+    buffer[len] = '\0';
+    *encoded_len = len;
+
+    return 0;
+}
+
+int hdr_encode_compressed_into(
+    const struct hdr_histogram* h, uint8_t* buffer, size_t capacity, size_t* compressed_len)
+{
+    struct hdr_encoder* encoder;
+    int rc;
+
+    if ((rc = hdr_encoder_init(&encoder)) != 0)
+    {
+        return rc;
+    }
+
+    rc = hdr_encoder_encode_into(encoder, h, buffer, capacity, compressed_len);
+    hdr_encoder_close(encoder);
+
+    return rc;
+}
+
+int hdr_log_encode_into(const struct hdr_histogram* h, char* buffer, size_t capacity, size_t* encoded_len)
+{
+    struct hdr_encoder* encoder;
+    int rc;
+
+    if ((rc = hdr_encoder_init(&encoder)) != 0)
+    {
+        return rc;
+    }
+
+    rc = hdr_encoder_encode_base64_into(encoder, h, buffer, capacity, encoded_len);
+    hdr_encoder_close(encoder);
+
+    return rc;
+}
+
+int hdr_encode_compressed(
+    struct hdr_histogram* h,
+    uint8_t** compressed_histogram,
+    size_t* compressed_len)
+{
+    struct hdr_encoder* encoder;
+    const uint8_t* compressed;
+    int rc;
+
+    if ((rc = hdr_encoder_init(&encoder)) != 0)
+    {
+        return rc;
+    }
+
+    rc = hdr_encoder_encode(encoder, h, &compressed, compressed_len);
+    if (0 == rc)
+    {
+        /* Hand the encoder's buffer over to the caller. */
+        *compressed_histogram = (uint8_t*) encoder->compressed;
+        encoder->compressed = NULL;
+    }
+
+    hdr_encoder_close(encoder);
+
+    return rc;
+}
+
+/* ########  ########  ######   #######  ########  #### ##    ##  ######   */
+/* ##     ## ##       ##    ## ##     ## ##     ##  ##  ###   ## ##    ##  */
+/* ##     ## ##       ##       ##     ## ##     ##  ##  ####  ## ##        */
+/* ##     ## ######   ##       ##     ## ##     ##  ##  ## ## ## ##   #### */
+/* ##     ## ##       ##       ##     ## ##     ##  ##  ##  #### ##    ##  */
+/* ##     ## ##       ##    ## ##     ## ##     ##  ##  ##   ### ##    ##  */
+/* ########  ########  ######   #######  ########  #### ##    ##  ######   */
+
+static void _apply_to_counts_16(int64_t* counts, const int16_t* counts_data, const int32_t counts_limit)
+{
+    int i;
+    for (i = 0; i < counts_limit; i++)
+    {
+        counts[i] += be16toh(counts_data[i]);
+    }
+}
+
+static void _apply_to_counts_32(int64_t* counts, const int32_t* counts_data, const int32_t counts_limit)
+{
+    int i;
+    for (i = 0; i < counts_limit; i++)
+    {
+        counts[i] += be32toh(counts_data[i]);
+    }
+}
+
+static void _apply_to_counts_64(int64_t* counts, const int64_t* counts_data, const int32_t counts_limit)
+{
+    int i;
+    for (i = 0; i < counts_limit; i++)
+    {
+        counts[i] += be64toh(counts_data[i]);
+    }
+}
+
+static int _apply_to_counts_zz(
+    int64_t* counts, int32_t counts_len, const uint8_t* counts_data, const int32_t data_limit)
+{
+    int32_t data_index;
+
+    if (0 != zig_zag_decode_counts(counts_data, data_limit, counts, counts_len, &data_index))
+    {
+        return HDR_TRAILING_ZEROS_INVALID;
+    }
+
+    if (data_index > data_limit)
+    {
+        return HDR_VALUE_TRUNCATED;
+    }
+    else if (data_index < data_limit)
+    {
+        return HDR_ENCODED_INPUT_TOO_LONG;
+    }
+
+    return 0;
+}
+
+static int _apply_to_counts_packed(
+    int64_t* counts, int32_t counts_len, const uint8_t* counts_data, const int32_t data_limit)
+{
+    int32_t data_index;
+
+    if (0 != packed_decode_counts(counts_data, data_limit, counts, counts_len, &data_index))
+    {
+        return EINVAL;
+    }
+
+    if (data_index > data_limit)
+    {
+        return HDR_VALUE_TRUNCATED;
+    }
+
+    return 0;
+}
+
+/* Adds the decoded counts to the first counts_len counts. */
+static int _apply_to_counts(
+    int64_t* counts, int32_t counts_len,
+    const int32_t word_size, const uint8_t* counts_data, const int32_t counts_limit)
+{
+    if (1 != word_size && counts_limit > counts_len)
+    {
+        return HDR_ENCODED_INPUT_TOO_LONG;
+    }
+
+    switch (word_size)
+    {
+        case 2:
+            _apply_to_counts_16(counts, (const int16_t*) counts_data, counts_limit);
+            return 0;
+
+        case 4:
+            _apply_to_counts_32(counts, (const int32_t*) counts_data, counts_limit);
+            return 0;
+
+        case 8:
+            _apply_to_counts_64(counts, (const int64_t*) counts_data, counts_limit);
+            return 0;
+
+        case 1:
+            return _apply_to_counts_zz(counts, counts_len, counts_data, counts_limit);
+
+        default:
+            return -1;
+    }
+}
+
+struct hdr_decoder
+{
+    z_stream strm;
+    int codec;
+    uint8_t* counts_array;
+    size_t counts_array_capacity;
+    /* Histogram of the encoded configuration, for merging into histograms */
+    /* whose counts are not index aligned with the encoded ones.           */
+    struct hdr_histogram view;
+    size_t view_counts_capacity;
+    int64_t* deltas;
+    size_t deltas_capacity;
+};
+
+int hdr_decoder_init(struct hdr_decoder** decoder)
+{
+    struct hdr_decoder* d = (struct hdr_decoder*) calloc(1, sizeof(struct hdr_decoder));
+    if (!d)
+    {
+        return ENOMEM;
+    }
+
+    strm_init(&d->strm);
+    if (inflateInit(&d->strm) != Z_OK)
+    {
+        free(d);
+        return HDR_INFLATE_INIT_FAIL;
+    }
+
+    *decoder = d;
+
+    return 0;
+}
+
+void hdr_decoder_close(struct hdr_decoder* decoder)
+{
+    if (!decoder)
+    {
+        return;
+    }
+
+    (void)inflateEnd(&decoder->strm);
+    free(decoder->counts_array);
+    free(decoder->view.counts);
+    free(decoder->deltas);
+    free(decoder);
+}
+
+/* The zeroed scratch buffer the counts are inflated into. */
+static uint8_t* decoder_counts_array(struct hdr_decoder* decoder, size_t len)
+{
+    if (ensure_capacity((void**) &decoder->counts_array, &decoder->counts_array_capacity, len))
+    {
+        return NULL;
+    }
+
+    memset(decoder->counts_array, 0, len);
+
+    return decoder->counts_array;
+}
+
+/* Picks the histogram the decoded counts are added to.  With nothing to merge  */
+/* into that is a new histogram.  When merging, the counts are added straight    */
+/* into the target if the encoded counts line up with its own, otherwise they    */
+/* are decoded into the decoder's view and recorded into the target afterwards.  */
+static int decoder_target(
+    struct hdr_decoder* decoder,
+    struct hdr_histogram* merge_into,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int32_t significant_figures,
+    struct hdr_histogram** target,
+    int32_t* counts_len)
+{
+    struct hdr_histogram_bucket_config cfg;
+    size_t counts_size;
+    int rc;
+
+    if (NULL == merge_into)
+    {
+        if ((rc = hdr_init(lowest_trackable_value, highest_trackable_value, significant_figures, target)) != 0)
+        {
+            return rc;
+        }
+
+        *counts_len = (*target)->counts_len;
+        return 0;
+    }
+
+    if ((rc = hdr_calculate_bucket_config(
+        lowest_trackable_value, highest_trackable_value, significant_figures, &cfg)) != 0)
+    {
+        return rc;
+    }
+
+    *counts_len = cfg.counts_len;
+
+    if (0 == merge_into->normalizing_index_offset &&
+        cfg.unit_magnitude == merge_into->unit_magnitude &&
+        cfg.sub_bucket_half_count_magnitude == merge_into->sub_bucket_half_count_magnitude &&
+        cfg.counts_len <= merge_into->counts_len)
+    {
+        *target = merge_into;
+        return 0;
+    }
+
+    counts_size = (size_t) cfg.counts_len * sizeof(int64_t);
+    if (ensure_capacity((void**) &decoder->view.counts, &decoder->view_counts_capacity, counts_size))
+    {
+        return ENOMEM;
+    }
+
+    memset(decoder->view.counts, 0, counts_size);
+    hdr_init_preallocated(&decoder->view, &cfg);
+    *target = &decoder->view;
+
+    return 0;
+}
+
+/* Completes a decode started by decoder_target, handing out or merging the result. */
+static int decoder_complete(
+    struct hdr_decoder* decoder,
+    struct hdr_histogram* target,
+    double conversion_ratio,
+    int result,
+    struct hdr_histogram** histogram)
+{
+    if (NULL == target)
+    {
+        return result;
+    }
+
+    if (target == *histogram)
+    {
+        /* Merged in place, a failure may have left part of the counts merged. */
+        hdr_reset_internal_counters(target);
+        return result;
+    }
+
+    if (target == &decoder->view)
+    {
+        if (0 == result)
+        {
+            hdr_reset_internal_counters(target);
+            hdr_add(*histogram, target);
+        }
+
+        return result;
+    }
+
+    if (0 != result)
+    {
+        hdr_close(target);
+        return result;
+    }
+
+    /* The counts are encoded in logical index order, whatever the encoder's offset was. */
+    target->normalizing_index_offset = 0;
+    target->conversion_ratio = conversion_ratio;
+    hdr_reset_internal_counters(target);
+    *histogram = target;
+
+    return result;
+}
+
+/* Reads the next len bytes of the encoded histogram into out, Z_FINISH */
+/* requiring them to be the last.                                      */
+static int decoder_read(struct hdr_decoder* decoder, uint8_t* out, size_t len, int flush)
+{
+    z_stream* strm = &decoder->strm;
+    int rc;
+
+    if (HDR_CODEC_STORED == decoder->codec)
+    {
+        if (strm->avail_in < len || (Z_FINISH == flush && strm->avail_in != len))
+        {
+            return EINVAL;
+        }
+
+        memcpy(out, strm->next_in, len);
+        strm->next_in += len;
+        strm->avail_in -= (uInt) len;
+
+        return 0;
+    }
+
+    strm->next_out = out;
+    strm->avail_out = (uInt) len;
+
+    rc = inflate(strm, flush);
+
+    if (Z_FINISH == flush)
+    {
+        return Z_STREAM_END == rc ? 0 : HDR_INFLATE_FAIL;
+    }
+
+    return (Z_OK == rc && 0 == strm->avail_out) ? 0 : HDR_INFLATE_FAIL;
+}
+
+/* Reads just the encoding header, leaving the stream at the start of the counts. */
+static int decoder_inflate_header(
+    struct hdr_decoder* decoder, const uint8_t* buffer, size_t length, struct hdr_header_info* info)
+{
+    const _compression_flyweight* compression_flyweight;
+    _encoding_flyweight_v0 flyweight_v0;
+    _encoding_flyweight_v3 flyweight;
+    struct hdr_histogram_bucket_config cfg;
+    z_stream* strm = &decoder->strm;
+    int32_t compression_cookie, compressed_len, encoding_cookie, expected_cookie;
+    int rc;
+
+    if (length < SIZEOF_COMPRESSION_FLYWEIGHT)
+    {
+        return EINVAL;
+    }
+
+    compression_flyweight = (const _compression_flyweight*) buffer;
+
+    decoder->codec = HDR_CODEC_DEFLATE;
+
+    compression_cookie = get_cookie_base(be32toh(compression_flyweight->cookie));
+    if (V0_COMPRESSION_COOKIE == compression_cookie)
+    {
+        info->version = 0;
+        expected_cookie = V0_ENCODING_COOKIE;
+    }
+    else if (V1_COMPRESSION_COOKIE == compression_cookie)
+    {
+        info->version = 1;
+        expected_cookie = V1_ENCODING_COOKIE;
+    }
+    else if (V2_COMPRESSION_COOKIE == compression_cookie)
+    {
+        info->version = 2;
+        expected_cookie = V2_ENCODING_COOKIE;
+    }
+    else if (STORED_COMPRESSION_COOKIE == compression_cookie)
+    {
+        decoder->codec = HDR_CODEC_STORED;
+        info->version = 2;
+        expected_cookie = V2_ENCODING_COOKIE;
+    }
+    else
+    {
+        return HDR_COMPRESSION_COOKIE_MISMATCH;
+    }
+
+    compressed_len = be32toh(compression_flyweight->length);
+
+    if (compressed_len < 0 || length - SIZEOF_COMPRESSION_FLYWEIGHT < (size_t)compressed_len)
+    {
+        return EINVAL;
+    }
+
+    if (HDR_CODEC_DEFLATE == decoder->codec && inflateReset(strm) != Z_OK)
+    {
+        return HDR_INFLATE_FAIL;
+    }
+
+    info->codec = decoder->codec;
+
+    strm->next_in = (uint8_t*) compression_flyweight->data;
+    strm->avail_in = (uInt) compressed_len;
+
+    if (0 == info->version)
+    {
+        rc = decoder_read(decoder, (uint8_t *) &flyweight_v0, SIZEOF_ENCODING_FLYWEIGHT_V0, Z_SYNC_FLUSH);
+    }
+    else
+    {
+        rc = decoder_read(decoder, (uint8_t *) &flyweight, SIZEOF_ENCODING_FLYWEIGHT_V1, Z_SYNC_FLUSH);
+    }
+
+    if (rc)
+    {
+        return rc;
+    }
+
+    if (0 == info->version)
+    {
+        encoding_cookie = be32toh(flyweight_v0.cookie);
+        info->significant_figures = be32toh(flyweight_v0.significant_figures);
+        info->lowest_trackable_value = be64toh(flyweight_v0.lowest_trackable_value);
+        info->highest_trackable_value = be64toh(flyweight_v0.highest_trackable_value);
+        info->conversion_ratio = 1.0;
+        info->total_count = be64toh(flyweight_v0.total_count);
+    }
+    else
+    {
+        encoding_cookie = be32toh(flyweight.cookie);
+        info->significant_figures = be32toh(flyweight.significant_figures);
+        info->lowest_trackable_value = be64toh(flyweight.lowest_trackable_value);
+        info->highest_trackable_value = be64toh(flyweight.highest_trackable_value);
+        info->conversion_ratio = int64_bits_to_double(be64toh(flyweight.conversion_ratio_bits));
+        info->total_count = -1;
+    }
+
+    /* Delta and V3 encoded counts share the V2 framing. */
+    info->delta = 2 == info->version && DELTA_ENCODING_COOKIE == get_cookie_base(encoding_cookie);
+    info->max_value = -1;
+
+    if (2 == info->version && V3_ENCODING_COOKIE == get_cookie_base(encoding_cookie))
+    {
+        rc = decoder_read(
+            decoder, (uint8_t *) &flyweight + SIZEOF_ENCODING_FLYWEIGHT_V1,
+            SIZEOF_ENCODING_FLYWEIGHT_V3 - SIZEOF_ENCODING_FLYWEIGHT_V1, Z_SYNC_FLUSH);
+        if (rc)
+        {
+            return rc;
+        }
+
+        info->version = 3;
+        info->total_count = be64toh(flyweight.total_count);
+        info->max_value = be64toh(flyweight.max_value);
+    }
+    else if (expected_cookie != get_cookie_base(encoding_cookie) && !info->delta)
+    {
+        return HDR_ENCODING_COOKIE_MISMATCH;
+    }
+
+    /* V2 and V3 counts are byte oriented, V0 and V1 use fixed size words. */
+    info->word_size = 2 <= info->version ? 1 : word_size_from_cookie(encoding_cookie);
+
+    if (2 != info->word_size && 4 != info->word_size && 8 != info->word_size && 2 > info->version)
+    {
+        return EINVAL;
+    }
+
+    if (0 == info->version)
+    {
+        /* V0 always carries the whole counts array. */
+        if (hdr_calculate_bucket_config(
+            info->lowest_trackable_value, info->highest_trackable_value, info->significant_figures, &cfg) != 0)
+        {
+            return EINVAL;
+        }
+
+        info->payload_len = cfg.counts_len * info->word_size;
+    }
+    else
+    {
+        info->payload_len = be32toh(flyweight.payload_len);
+    }
+
+    if (info->payload_len < 0)
+    {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+int hdr_decoder_decode_header(
+    struct hdr_decoder* decoder, const uint8_t* buffer, size_t length, struct hdr_header_info* info)
+{
+    return decoder_inflate_header(decoder, buffer, length, info);
+}
+
+int hdr_decode_header(const uint8_t* buffer, size_t length, struct hdr_header_info* info)
+{
+    struct hdr_decoder* decoder;
+    int rc;
+
+    if ((rc = hdr_decoder_init(&decoder)) != 0)
+    {
+        return rc;
+    }
+
+    rc = decoder_inflate_header(decoder, buffer, length, info);
+    hdr_decoder_close(decoder);
+
+    return rc;
+}
+
+int hdr_decoder_decode(
+    struct hdr_decoder* decoder, const uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+{
+    struct hdr_histogram* h = NULL;
+    struct hdr_header_info info;
+    uint8_t* counts_array = NULL;
+    int32_t counts_len;
+    int result = 0;
+    int rc = 0;
+
+    info.conversion_ratio = 1.0;
+
+    rc = decoder_inflate_header(decoder, buffer, length, &info);
+    if (rc)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, rc);
+    }
+
+    /* Only a log reader holding the previous interval can apply a delta. */
+    if (info.delta)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, HDR_LOG_DELTA_WITHOUT_KEYFRAME);
+    }
+
+    rc = decoder_target(
+        decoder, *histogram, info.lowest_trackable_value, info.highest_trackable_value, info.significant_figures,
+        &h, &counts_len);
+    if (rc)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, rc);
+    }
+
+    /* Make sure there at least 9 bytes to read */
+    /* if there is a corrupt value at the end */
+    /* of the array we won't read corrupt data or crash. */
+    if ((counts_array = decoder_counts_array(decoder, (size_t) info.payload_len + MAX_BYTES_LEB128)) == NULL)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+    }
+
+    rc = decoder_read(decoder, counts_array, (size_t) info.payload_len, Z_FINISH);
+    if (rc)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, rc);
+    }
+
+    if (3 == info.version)
+    {
+        rc = _apply_to_counts_packed(h->counts, counts_len, counts_array, info.payload_len);
+    }
+    else
+    {
+        rc = _apply_to_counts(h->counts, counts_len, info.word_size, counts_array, info.payload_len / info.word_size);
+    }
+    if (rc)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, rc);
+    }
+
+cleanup:
+    return decoder_complete(decoder, h, info.conversion_ratio, result, histogram);
+}
+
+/* Adds delta encoded counts, whose header has been read, to the counts of the */
+/* previous interval in h.                                                     */
+static int decoder_apply_delta(
+    struct hdr_decoder* decoder, const struct hdr_header_info* info, struct hdr_histogram* h)
+{
+    size_t deltas_size = (size_t) h->counts_len * sizeof(int64_t);
+    uint8_t* counts_array;
+    int32_t i;
+    int rc;
+
+    if ((counts_array = decoder_counts_array(decoder, (size_t) info->payload_len + MAX_BYTES_LEB128)) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    if ((rc = decoder_read(decoder, counts_array, (size_t) info->payload_len, Z_FINISH)) != 0)
+    {
+        return rc;
+    }
+
+    if (ensure_capacity((void**) &decoder->deltas, &decoder->deltas_capacity, deltas_size))
+    {
+        return ENOMEM;
+    }
+
+    memset(decoder->deltas, 0, deltas_size);
+
+    if ((rc = _apply_to_counts_zz(decoder->deltas, h->counts_len, counts_array, info->payload_len)) != 0)
+    {
+        return rc;
+    }
+
+    rc = 0;
+    for (i = 0; i < h->counts_len; i++)
+    {
+        uint64_t zig_zag = (uint64_t) decoder->deltas[i];
+
+        h->counts[i] += (int64_t) (zig_zag >> 1) ^ -(int64_t) (zig_zag & 1);
+        rc |= h->counts[i] < 0;
+    }
+
+    hdr_reset_internal_counters(h);
+
+    return rc ? EINVAL : 0;
+}
+
+int hdr_decode_compressed(
+    uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+{
+    struct hdr_decoder* decoder;
+    int rc;
+
+    if ((rc = hdr_decoder_init(&decoder)) != 0)
+    {
+        return rc;
+    }
+
+    rc = hdr_decoder_decode(decoder, buffer, length, histogram);
+    hdr_decoder_close(decoder);
+
+    return rc;
+}
+
+/* ##      ## ########  #### ######## ######## ########  */
+/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
+/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
+/* ##  ##  ## ########   ##     ##    ######   ########  */
+/* ##  ##  ## ##   ##    ##     ##    ##       ##   ##   */
+/* ##  ##  ## ##    ##   ##     ##    ##       ##    ##  */
+/*  ###  ###  ##     ## ####    ##    ######## ##     ## */
+
+/* The previous interval of one tag and histogram configuration in a delta */
+/* encoded log.                                                             */
+struct hdr_log_delta
+{
+    /* NULL for untagged entries. */
+    char* tag;
+    struct hdr_histogram* previous;
+    int32_t counts_limit;
+    /* Intervals since the last keyframe, -1 before the first one. */
+    int32_t intervals;
+    struct hdr_log_delta* next;
+};
+
+static bool tag_equals(const char* tag, const char* other, size_t other_len)
+{
+    if (NULL == tag || NULL == other)
+    {
+        return tag == other;
+    }
+
+    return strlen(tag) == other_len && memcmp(tag, other, other_len) == 0;
+}
+
+static int log_delta_for(
+    struct hdr_log_delta** deltas,
+    const char* tag,
+    size_t tag_len,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int32_t significant_figures,
+    struct hdr_log_delta** result)
+{
+    struct hdr_log_delta* delta;
+    int rc;
+
+    for (delta = *deltas; NULL != delta; delta = delta->next)
+    {
+        if (tag_equals(delta->tag, tag, tag_len) &&
+            delta->previous->lowest_trackable_value == lowest_trackable_value &&
+            delta->previous->highest_trackable_value == highest_trackable_value &&
+            delta->previous->significant_figures == significant_figures)
+        {
+            *result = delta;
+            return 0;
+        }
+    }
+
+    if ((delta = (struct hdr_log_delta*) calloc(1, sizeof(struct hdr_log_delta))) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    if (NULL != tag)
+    {
+        if ((delta->tag = (char*) malloc(tag_len + 1)) == NULL)
+        {
+            free(delta);
+            return ENOMEM;
+        }
+
+        memcpy(delta->tag, tag, tag_len);
+        delta->tag[tag_len] = '\0';
+    }
+
+    rc = hdr_init(lowest_trackable_value, highest_trackable_value, significant_figures, &delta->previous);
+    if (rc)
+    {
+        free(delta->tag);
+        free(delta);
+        return rc;
+    }
+
+    delta->intervals = -1;
+    delta->next = *deltas;
+    *deltas = delta;
+    *result = delta;
+
+    return 0;
+}
+
+static void log_deltas_free(struct hdr_log_delta* deltas)
+{
+    while (NULL != deltas)
+    {
+        struct hdr_log_delta* next = deltas->next;
+
+        hdr_close(deltas->previous);
+        free(deltas->tag);
+        free(deltas);
+        deltas = next;
+    }
+}
+
+int hdr_log_writer_init(struct hdr_log_writer* writer)
+{
+    writer->keyframe_interval = 0;
+    writer->encoder = NULL;
+    writer->deltas = NULL;
+    writer->base64 = NULL;
+    writer->base64_capacity = 0;
+
+    return 0;
+}
+
+int hdr_log_writer_enable_deltas(struct hdr_log_writer* writer, int32_t keyframe_interval)
+{
+    if (keyframe_interval < 1)
+    {
+        return EINVAL;
+    }
+
+    writer->keyframe_interval = keyframe_interval;
+
+    return 0;
+}
+
+void hdr_log_writer_close(struct hdr_log_writer* writer)
+{
+    hdr_encoder_close(writer->encoder);
+    log_deltas_free(writer->deltas);
+    free(writer->base64);
+    writer->encoder = NULL;
+    writer->deltas = NULL;
+    writer->base64 = NULL;
+    writer->base64_capacity = 0;
+}
+
+#define LOG_VERSION "1.3"
+#define LOG_MAJOR_VERSION 1
+
+static int print_user_prefix(FILE* f, const char* prefix)
+{
+    if (!prefix)
+    {
+        return 0;
+    }
+
+    return fprintf(f, "#[%s]\n", prefix);
+}
+
+static int print_version(FILE* f, const char* version)
+{
+    return fprintf(f, "#[Histogram log format version %s]\n", version);
+}
+
+static int print_time(FILE* f, hdr_timespec* timestamp)
+{
+    char time_str[128];
+    struct tm date_time;
+
+    if (!timestamp)
+    {
+        return 0;
+    }
+
+#if defined(__WINDOWS__)
+    _gmtime32_s(&date_time, &timestamp->tv_sec);
+#else
+    gmtime_r(&timestamp->tv_sec, &date_time);
+#endif
+
+    strftime(time_str, 128, "%a %b %X %Z %Y", &date_time);
+
+    return fprintf(
+        f, "#[StartTime: %.3f (seconds since epoch), %s]\n",
+        hdr_timespec_as_double(timestamp), time_str);
+}
+
+static int print_delta(FILE* f, int32_t keyframe_interval)
+{
+    if (keyframe_interval < 1)
+    {
+        return 0;
+    }
+
+    return fprintf(f, "#[Delta encoded, keyframe interval %d]\n", keyframe_interval);
+}
+
+static int print_header(FILE* f)
+{
+    return fprintf(f, "\"StartTimestamp\",\"EndTimestamp\",\"Interval_Max\",\"Interval_Compressed_Histogram\"\n");
+}
+
+/* Example log                                                                       */
+/* #[Logged with jHiccup version 2.0.3-SNAPSHOT]                                     */
+/* #[Histogram log format version 1.01]                                              */
+/* #[StartTime: 1403476110.183 (seconds since epoch), Mon Jun 23 10:28:30 NZST 2014] */
+/* "StartTimestamp","EndTimestamp","Interval_Max","Interval_Compressed_Histogram"    */
+int hdr_log_write_header(
+    struct hdr_log_writer* writer, FILE* file,
+    const char* user_prefix, hdr_timespec* timestamp)
+{
+    if (print_user_prefix(file, user_prefix) < 0)
+    {
+        return EIO;
+    }
+    if (print_version(file, LOG_VERSION) < 0)
+    {
+        return EIO;
+    }
+    if (print_time(file, timestamp) < 0)
+    {
+        return EIO;
+    }
+    if (print_delta(file, writer->keyframe_interval) < 0)
+    {
+        return EIO;
+    }
+    if (print_header(file) < 0)
+    {
+        return EIO;
+    }
+
+    return 0;
+}
+
+/* Copies the counts of h into counts in logical index order. */
+static void copy_logical_counts(int64_t* counts, const struct hdr_histogram* h)
+{
+    int32_t raw_from = raw_counts_index(h, 0);
+    size_t head_len = (size_t) (h->counts_len - raw_from);
+
+    memcpy(counts, &h->counts[raw_from], head_len * sizeof(int64_t));
+    memcpy(&counts[head_len], h->counts, (size_t) raw_from * sizeof(int64_t));
+}
+
+/* Encodes h as a keyframe or as its difference from the previous interval with */
+/* the same configuration, into the writer's encoder.                          */
+static int log_writer_encode_delta(
+    struct hdr_log_writer* writer,
+    const char* tag,
+    const struct hdr_histogram* h,
+    const uint8_t** compressed_histogram,
+    size_t* compressed_len)
+{
+    struct hdr_log_delta* delta;
+    struct hdr_encoder* encoder;
+    int32_t counts_limit = encoded_counts_limit(h);
+    bool keyframe;
+    size_t bound;
+    int rc;
+
+    encoder = writer->encoder;
+
+    rc = log_delta_for(
+        &writer->deltas, tag, NULL == tag ? 0 : strlen(tag),
+        h->lowest_trackable_value, h->highest_trackable_value, h->significant_figures, &delta);
+    if (rc)
+    {
+        return rc;
+    }
+
+    keyframe = delta->intervals < 0 || delta->intervals + 1 >= writer->keyframe_interval;
+
+    bound = encode_bound(keyframe || counts_limit > delta->counts_limit ? counts_limit : delta->counts_limit);
+    if (ensure_capacity((void**) &encoder->compressed, &encoder->compressed_capacity, bound))
+    {
+        return ENOMEM;
+    }
+
+    rc = encoder_encode_into(
+        encoder, h, keyframe ? NULL : delta->previous->counts, delta->counts_limit,
+        (uint8_t*) encoder->compressed, bound, compressed_len);
+    if (rc)
+    {
+        return rc;
+    }
+
+    copy_logical_counts(delta->previous->counts, h);
+    delta->counts_limit = counts_limit;
+    delta->intervals = keyframe ? 0 : delta->intervals + 1;
+
+    *compressed_histogram = (const uint8_t*) encoder->compressed;
+
+    return 0;
+}
+
+/* Tags end at the first comma and lines at the first whitespace. */
+static bool valid_tag(const char* tag)
+{
+    const char* c;
+
+    for (c = tag; '\0' != *c; c++)
+    {
+        if (',' == *c || isspace((unsigned char) *c))
+        {
+            return false;
+        }
+    }
+
+    return c != tag;
+}
+
+int hdr_log_write(
+    struct hdr_log_writer* writer,
+    FILE* file,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* end_timestamp,
+    struct hdr_histogram* histogram)
+{
+    return hdr_log_write_tagged(writer, file, NULL, start_timestamp, end_timestamp, histogram);
+}
+
+int hdr_log_write_tagged(
+    struct hdr_log_writer* writer,
+    FILE* file,
+    const char* tag,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* end_timestamp,
+    struct hdr_histogram* histogram)
+{
+    const uint8_t* compressed = NULL;
+    size_t compressed_len = 0;
+    size_t encoded_len;
+    int rc;
+
+    if (NULL != tag && !valid_tag(tag))
+    {
+        return EINVAL;
+    }
+
+    /* The encoder and line buffer are kept for the following entries. */
+    if (NULL == writer->encoder && (rc = hdr_encoder_init(&writer->encoder)) != 0)
+    {
+        return rc;
+    }
+
+    if (writer->keyframe_interval > 0)
+    {
+        rc = log_writer_encode_delta(writer, tag, histogram, &compressed, &compressed_len);
+    }
+    else
+    {
+        rc = hdr_encoder_encode(writer->encoder, histogram, &compressed, &compressed_len);
+    }
+
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    encoded_len = hdr_base64_encoded_len(compressed_len);
+    if (ensure_capacity((void**) &writer->base64, &writer->base64_capacity, encoded_len + 1))
+    {
+        return ENOMEM;
+    }
+
+    rc = hdr_base64_encode(compressed, compressed_len, writer->base64, encoded_len);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    writer->base64[encoded_len] = '\0';
+
+    if ((NULL != tag && fprintf(file, "Tag=%s,", tag) < 0) ||
+        fprintf(
+            file, "%.3f,%.3f,%"PRIu64".0,%s\n",
+            hdr_timespec_as_double(start_timestamp),
+            hdr_timespec_as_double(end_timestamp),
+            hdr_max(histogram),
+            writer->base64) < 0)
+    {
+        return EIO;
+    }
+
+    return 0;
+}
+
+/* ########  ########    ###    ########  ######## ########  */
+/* ##     ## ##         ## ##   ##     ## ##       ##     ## */
+/* ##     ## ##        ##   ##  ##     ## ##       ##     ## */
+/* ########  ######   ##     ## ##     ## ######   ########  */
+/* ##   ##   ##       ######### ##     ## ##       ##   ##   */
+/* ##    ##  ##       ##     ## ##     ## ##       ##    ##  */
+/* ##     ## ######## ##     ## ########  ######## ##     ## */
+
+int hdr_log_reader_init(struct hdr_log_reader* reader)
+{
+    reader->major_version = 0;
+    reader->minor_version = 0;
+    reader->start_timestamp.tv_sec = 0;
+    reader->start_timestamp.tv_nsec = 0;
+    reader->keyframe_interval = 0;
+    reader->decoder = NULL;
+    reader->deltas = NULL;
+    reader->tag = NULL;
+    reader->tag_capacity = 0;
+    reader->line = NULL;
+    reader->line_capacity = 0;
+    reader->compressed = NULL;
+    reader->compressed_capacity = 0;
+    reader->keep_buffers = false;
+
+    return 0;
+}
+
+void hdr_log_reader_close(struct hdr_log_reader* reader)
+{
+    hdr_decoder_close(reader->decoder);
+    log_deltas_free(reader->deltas);
+    free(reader->tag);
+    free(reader->line);
+    free(reader->compressed);
+    reader->decoder = NULL;
+    reader->deltas = NULL;
+    reader->tag = NULL;
+    reader->tag_capacity = 0;
+    reader->line = NULL;
+    reader->line_capacity = 0;
+    reader->compressed = NULL;
+    reader->compressed_capacity = 0;
+}
+
+/* Frees the decoder and the line and decompression buffers once a read is */
+/* done, unless hdr_log_read_into asked the reader to keep them.           */
+static void log_reader_release_buffers(struct hdr_log_reader* reader)
+{
+    if (reader->keep_buffers)
+    {
+        return;
+    }
+
+    hdr_decoder_close(reader->decoder);
+    free(reader->line);
+    free(reader->compressed);
+    reader->decoder = NULL;
+    reader->line = NULL;
+    reader->line_capacity = 0;
+    reader->compressed = NULL;
+    reader->compressed_capacity = 0;
+}
+
+static void scan_log_format(struct hdr_log_reader* reader, const char* line, const char* end)
+{
+    if (match_prefix(&line, end, "#[Histogram log format version") &&
+        parse_int(&line, end, &reader->major_version) &&
+        match_prefix(&line, end, "."))
+    {
+        parse_int(&line, end, &reader->minor_version);
+    }
+}
+
+static void scan_start_time(struct hdr_log_reader* reader, const char* line, const char* end)
+{
+    double timestamp = 0.0;
+
+    if (match_prefix(&line, end, "#[StartTime:") && parse_double(&line, end, &timestamp))
+    {
+        hdr_timespec_from_double(&reader->start_timestamp, timestamp);
+    }
+}
+
+static void scan_delta(struct hdr_log_reader* reader, const char* line, const char* end)
+{
+    int keyframe_interval;
+
+    if (match_prefix(&line, end, "#[Delta encoded, keyframe interval") &&
+        parse_int(&line, end, &keyframe_interval))
+    {
+        reader->keyframe_interval = keyframe_interval;
+    }
+}
+
+static void scan_header_line(struct hdr_log_reader* reader, const char* line, const char* end)
+{
+    scan_log_format(reader, line, end);
+    scan_start_time(reader, line, end);
+    scan_delta(reader, line, end);
+}
+
+static bool validate_log_version(struct hdr_log_reader* reader)
+{
+    return reader->major_version == LOG_MAJOR_VERSION &&
+        (reader->minor_version == 0 || reader->minor_version == 1 ||
+            reader->minor_version == 2 || reader->minor_version == 3);
+}
+
+#if defined(_MSC_VER)
+
+static ssize_t hdr_read_chunk(char* buffer, size_t length, char terminator, FILE* stream)
+{
+    if (buffer == NULL || length == 0)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        int c = fgetc(stream);
+        buffer[i] = (char)c;
+        if (c == (int) '\0' || c == (int) terminator || c == EOF)
+        {
+            buffer[i] = '\0';
+            return i;
+        }
+    }
+
+    return length;
+}
+
+/* Reads a line into *lineptr, growing it as getline does. */
+static ssize_t hdr_getline(char** lineptr, size_t* capacity, FILE* stream)
+{
+    size_t used = 0;
+
+    if (stream == NULL)
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        if (NULL == *lineptr || *capacity - used < 2)
+        {
+            size_t allocation = NULL == *lineptr ? 256 : *capacity * 2;
+            char* grown = realloc(*lineptr, allocation);
+            if (grown == NULL)
+            {
+                return -1;
+            }
+
+            *lineptr = grown;
+            *capacity = allocation;
+        }
+
+        size_t wanted = *capacity - used - 1;
+        size_t read_length = hdr_read_chunk(*lineptr + used, wanted, '\n', stream);
+        used += read_length;
+
+        if (read_length < wanted)
+        {
+            (*lineptr)[used] = '\0';
+            return used;
+        }
+    }
+}
+
+#else
+static ssize_t hdr_getline(char** lineptr, size_t* capacity, FILE* stream)
+{
+    return getline(lineptr, capacity, stream);
+}
+#endif
+
+int hdr_log_read_header(struct hdr_log_reader* reader, FILE* file)
+{
+    ssize_t read;
+    int result = 0;
+
+    bool parsing_header = true;
+
+    do
+    {
+        int c = fgetc(file);
+        ungetc(c, file);
+
+        switch (c)
+        {
+
+        case '#':
+            if ((read = hdr_getline(&reader->line, &reader->line_capacity, file)) == -1)
+            {
+                FAIL_AND_CLEANUP(cleanup, result, EIO);
+            }
+
+            scan_header_line(reader, reader->line, reader->line + read);
+            break;
+
+        case '"':
+            if (hdr_getline(&reader->line, &reader->line_capacity, file) == -1)
+            {
+                FAIL_AND_CLEANUP(cleanup, result, EIO);
+            }
+
+            parsing_header = false;
+            break;
+
+        default:
+            parsing_header = false;
+        }
+    }
+    while (parsing_header);
+
+    if (!validate_log_version(reader))
+    {
+        FAIL_AND_CLEANUP(cleanup, result, HDR_LOG_INVALID_VERSION);
+    }
+
+cleanup:
+    log_reader_release_buffers(reader);
+
+    return result;
+}
+
+/* Decodes an entry of a delta encoded log, keeping the decoded counts as the */
+/* previous interval for the next delta with the same tag and configuration.  */
+static int log_reader_decode_delta(
+    struct hdr_log_reader* reader, const struct hdr_log_entry* entry,
+    const uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+{
+    struct hdr_header_info info;
+    struct hdr_log_delta* delta;
+    struct hdr_histogram* previous;
+    int rc;
+
+    if (NULL == reader->decoder && (rc = hdr_decoder_init(&reader->decoder)) != 0)
+    {
+        return rc;
+    }
+
+    if ((rc = hdr_decoder_decode_header(reader->decoder, buffer, length, &info)) != 0)
+    {
+        return rc;
+    }
+
+    rc = log_delta_for(
+        &reader->deltas, entry->tag, entry->tag_len,
+        info.lowest_trackable_value, info.highest_trackable_value, info.significant_figures, &delta);
+    if (rc)
+    {
+        return rc;
+    }
+
+    previous = delta->previous;
+
+    if (!info.delta)
+    {
+        hdr_reset(previous);
+        rc = hdr_decoder_decode(reader->decoder, buffer, length, &previous);
+    }
+    else if (delta->intervals < 0)
+    {
+        rc = HDR_LOG_DELTA_WITHOUT_KEYFRAME;
+    }
+    else
+    {
+        rc = decoder_apply_delta(reader->decoder, &info, previous);
+    }
+
+    if (rc)
+    {
+        /* The previous counts are unusable until the next keyframe. */
+        delta->intervals = -1;
+        return rc;
+    }
+
+    delta->intervals = info.delta ? delta->intervals + 1 : 0;
+    previous->conversion_ratio = info.conversion_ratio;
+
+    /* Entries the reader filters out only bring the previous counts up to date. */
+    if (NULL == histogram)
+    {
+        return 0;
+    }
+
+    if (NULL != *histogram)
+    {
+        hdr_add(*histogram, previous);
+        return 0;
+    }
+
+    rc = hdr_init(
+        previous->lowest_trackable_value, previous->highest_trackable_value, previous->significant_figures,
+        histogram);
+    if (rc)
+    {
+        return rc;
+    }
+
+    memcpy((*histogram)->counts, previous->counts, (size_t) previous->counts_len * sizeof(int64_t));
+    (*histogram)->total_count = previous->total_count;
+    (*histogram)->min_value = previous->min_value;
+    (*histogram)->max_value = previous->max_value;
+    (*histogram)->conversion_ratio = previous->conversion_ratio;
+
+    return 0;
+}
+
+/* Splits an interval line, "[Tag=<tag>,]<start>,<length>,<max>,<histogram>", */
+/* in a single pass, pointing the tag and base64 spans of entry into the line. */
+static bool parse_interval_line(const char* line, const char* end, struct hdr_log_entry* entry)
+{
+    double begin_timestamp, end_timestamp;
+
+    entry->tag = NULL;
+    entry->tag_len = 0;
+
+    if (match_prefix(&line, end, "Tag="))
+    {
+        const char* tag_end = (const char*) memchr(line, ',', (size_t) (end - line));
+
+        if (NULL == tag_end || tag_end == line)
+        {
+            return false;
+        }
+
+        entry->tag = line;
+        entry->tag_len = (size_t) (tag_end - line);
+        line = tag_end + 1;
+    }
+
+    if (!parse_double(&line, end, &begin_timestamp) || !match_prefix(&line, end, ",") ||
+        !parse_double(&line, end, &end_timestamp) || !match_prefix(&line, end, ",") ||
+        !parse_double(&line, end, &entry->max_value) || !match_prefix(&line, end, ","))
+    {
+        return false;
+    }
+
+    while (line < end && isspace((unsigned char) *line))
+    {
+        line++;
+    }
+
+    entry->base64 = line;
+    while (line < end && '\0' != *line && !isspace((unsigned char) *line))
+    {
+        line++;
+    }
+    entry->base64_len = (size_t) (line - entry->base64);
+
+    hdr_timespec_from_double(&entry->timestamp, begin_timestamp);
+    hdr_timespec_from_double(&entry->interval, end_timestamp);
+
+    return 0 < entry->base64_len;
+}
+
+/* Decodes the base64 histogram of an interval line through the caller's scratch */
+/* buffer, with the reader's own decoder when it has one.  A NULL histogram only */
+/* applies a delta encoded entry to the counts of its tag.                       */
+static int log_reader_decode_base64(
+    struct hdr_log_reader* reader, const struct hdr_log_entry* entry,
+    uint8_t** compressed, size_t* compressed_capacity, struct hdr_histogram** histogram)
+{
+    size_t compressed_len = hdr_base64_decoded_len(entry->base64_len);
+    int rc;
+
+    if (0 == compressed_len)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        return EINVAL;
     }
 
-    /* Give the temp uncompressed array a little bif of extra */
-    counts_array_len = counts_limit * word_size;
+    if (ensure_capacity((void**) compressed, compressed_capacity, compressed_len))
+    {
+        return ENOMEM;
+    }
 
-    if ((counts_array = calloc(1, (size_t) counts_array_len)) == NULL)
+    if ((rc = hdr_base64_decode(entry->base64, entry->base64_len, *compressed, compressed_len)) != 0)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        return rc;
     }
 
-    strm.next_out = counts_array;
-    strm.avail_out = (uInt) counts_array_len;
+    if (reader->keyframe_interval > 0)
+    {
+        return log_reader_decode_delta(reader, entry, *compressed, compressed_len, histogram);
+    }
 
-    if (inflate(&strm, Z_FINISH) != Z_STREAM_END)
+    if (NULL == reader->decoder && (rc = hdr_decoder_init(&reader->decoder)) != 0)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        return rc;
     }
 
-    _apply_to_counts(h, word_size, counts_array, counts_limit);
+    return hdr_decoder_decode(reader->decoder, *compressed, compressed_len, histogram);
+}
 
-    h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
-    h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
-    hdr_reset_internal_counters(h);
+int hdr_log_read(
+    struct hdr_log_reader* reader, FILE* file, struct hdr_histogram** histogram,
+    hdr_timespec* timestamp, hdr_timespec* interval)
+{
+    return hdr_log_read_tagged(reader, file, NULL, histogram, timestamp, interval, NULL);
+}
 
-cleanup:
-    (void)inflateEnd(&strm);
-    free(counts_array);
+static bool tag_matches(const char* tag_filter, const struct hdr_log_entry* entry)
+{
+    return NULL == tag_filter || (NULL != entry->tag && tag_equals(tag_filter, entry->tag, entry->tag_len));
+}
+
+void hdr_log_filter_init(struct hdr_log_filter* filter)
+{
+    filter->tag = NULL;
+    filter->min_interval_max = 0;
+    filter->start_time = -HUGE_VAL;
+    filter->end_time = HUGE_VAL;
+}
+
+bool hdr_log_filter_matches(const struct hdr_log_filter* filter, const struct hdr_log_entry* entry)
+{
+    double start_time;
 
-    if (result != 0)
+    if (NULL == filter)
     {
-        free(h);
+        return true;
     }
-    else if (NULL == *histogram)
+
+    start_time = hdr_timespec_as_double(&entry->timestamp);
+
+    return tag_matches(filter->tag, entry) &&
+        filter->min_interval_max <= entry->max_value &&
+        filter->start_time <= start_time && start_time < filter->end_time;
+}
+
+/* Passes over an entry the filter rejected.  Its histogram is not decoded,   */
+/* unless it is a delta of a tag that is being read: later entries of the tag */
+/* build on its counts.  The previous intervals of any other tag are dropped, */
+/* so reading that tag later fails until its next keyframe instead of adding  */
+/* a delta to stale counts.                                                   */
+static int log_reader_skip(
+    struct hdr_log_reader* reader, const struct hdr_log_filter* filter, const struct hdr_log_entry* entry,
+    uint8_t** compressed, size_t* compressed_capacity)
+{
+    struct hdr_log_delta* delta;
+
+    if (reader->keyframe_interval <= 0)
     {
-        *histogram = h;
+        return 0;
     }
-    else
+
+    if (tag_matches(filter->tag, entry))
     {
-        hdr_add(*histogram, h);
-        free(h);
+        return log_reader_decode_base64(reader, entry, compressed, compressed_capacity, NULL);
     }
 
-    return result;
+    for (delta = reader->deltas; NULL != delta; delta = delta->next)
+    {
+        if (tag_equals(delta->tag, entry->tag, entry->tag_len))
+        {
+            delta->intervals = -1;
+        }
+    }
+
+    return 0;
 }
 
-static int hdr_decode_compressed_v2(
-    _compression_flyweight* compression_flyweight,
-    size_t length,
-    struct hdr_histogram** histogram)
+/* Reads and splits the next interval line into the reader's line buffer. */
+static int log_read_entry(struct hdr_log_reader* reader, FILE* file, struct hdr_log_entry* entry)
 {
-    struct hdr_histogram* h = NULL;
-    int result = 0;
-    int rc = 0;
-    uint8_t* counts_array = NULL;
-    _encoding_flyweight_v1 encoding_flyweight;
-    z_stream strm;
-    int32_t compressed_length, encoding_cookie, counts_limit, significant_figures;
-    int64_t lowest_trackable_value, highest_trackable_value;
+    ssize_t read;
+
+    /* Decoding earlier entries may leave errno set, which would read as an */
+    /* I/O error at the end of the log.                                     */
+    errno = 0;
+    read = hdr_getline(&reader->line, &reader->line_capacity, file);
+    if (-1 == read)
+    {
+        return 0 == errno ? EOF : EIO;
+    }
 
-    strm_init(&strm);
-    if (inflateInit(&strm) != Z_OK)
+    read = null_trailing_whitespace(reader->line, read);
+    if (0 == read)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        return EOF;
     }
 
-    compressed_length = be32toh(compression_flyweight->length);
+    return parse_interval_line(reader->line, reader->line + read, entry) ? 0 : EINVAL;
+}
+
+int hdr_log_read_tagged(
+    struct hdr_log_reader* reader, FILE* file, const char* tag_filter, struct hdr_histogram** histogram,
+    hdr_timespec* timestamp, hdr_timespec* interval, const char** tag)
+{
+    struct hdr_log_filter filter;
+
+    hdr_log_filter_init(&filter);
+    filter.tag = tag_filter;
+
+    return hdr_log_read_filtered(reader, file, &filter, histogram, timestamp, interval, tag);
+}
+
+static int log_reader_read_filtered(
+    struct hdr_log_reader* reader, FILE* file, const struct hdr_log_filter* filter,
+    struct hdr_histogram** histogram, hdr_timespec* timestamp, hdr_timespec* interval, const char** tag)
+{
+    struct hdr_log_entry entry;
+    int rc;
 
-    if (compressed_length < 0 || length - SIZEOF_COMPRESSION_FLYWEIGHT < (size_t)compressed_length)
+    /* Entries are filtered on the clear text fields of their line, before */
+    /* their histogram is decoded.                                         */
+    for (;;)
     {
-        FAIL_AND_CLEANUP(cleanup, result, EINVAL);
+        if ((rc = log_read_entry(reader, file, &entry)) != 0)
+        {
+            return rc;
+        }
+
+        if (hdr_log_filter_matches(filter, &entry))
+        {
+            break;
+        }
+
+        rc = log_reader_skip(reader, filter, &entry, &reader->compressed, &reader->compressed_capacity);
+        if (rc)
+        {
+            return rc;
+        }
     }
 
-    strm.next_in = compression_flyweight->data;
-    strm.avail_in = (uInt) compressed_length;
-    strm.next_out = (uint8_t *) &encoding_flyweight;
-    strm.avail_out = SIZEOF_ENCODING_FLYWEIGHT_V1;
+    /* The histogram is decoded straight from the line, only its bytes are copied. */
+    rc = log_reader_decode_base64(reader, &entry, &reader->compressed, &reader->compressed_capacity, histogram);
+    if (rc)
+    {
+        return rc;
+    }
 
-    if (inflate(&strm, Z_SYNC_FLUSH) != Z_OK)
+    if (NULL != timestamp)
+    {
+        *timestamp = entry.timestamp;
+    }
+    if (NULL != interval)
+    {
+        *interval = entry.interval;
+    }
+    if (NULL != tag)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        *tag = NULL;
+
+        if (NULL != entry.tag)
+        {
+            if (ensure_capacity((void**) &reader->tag, &reader->tag_capacity, entry.tag_len + 1))
+            {
+                return ENOMEM;
+            }
+
+            memcpy(reader->tag, entry.tag, entry.tag_len);
+            reader->tag[entry.tag_len] = '\0';
+            *tag = reader->tag;
+        }
     }
 
-    encoding_cookie = get_cookie_base(be32toh(encoding_flyweight.cookie));
-    if (V2_ENCODING_COOKIE != encoding_cookie)
+    return 0;
+}
+
+int hdr_log_read_filtered(
+    struct hdr_log_reader* reader, FILE* file, const struct hdr_log_filter* filter,
+    struct hdr_histogram** histogram, hdr_timespec* timestamp, hdr_timespec* interval, const char** tag)
+{
+    int rc = log_reader_read_filtered(reader, file, filter, histogram, timestamp, interval, tag);
+
+    log_reader_release_buffers(reader);
+
+    return rc;
+}
+
+int hdr_log_read_into(
+    struct hdr_log_reader* reader, FILE* file, const char* tag_filter, struct hdr_histogram* histogram,
+    hdr_timespec* timestamp, hdr_timespec* interval, const char** tag)
+{
+    reader->keep_buffers = true;
+
+    hdr_reset(histogram);
+
+    return hdr_log_read_tagged(reader, file, tag_filter, &histogram, timestamp, interval, tag);
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+static int log_file_map(const char* path, const char** data, size_t* length)
+{
+    HANDLE file = CreateFileA(
+        path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER file_size;
+    HANDLE mapping;
+    void* view = NULL;
+
+    if (INVALID_HANDLE_VALUE == file)
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_ENCODING_COOKIE_MISMATCH);
+        return ERROR_FILE_NOT_FOUND == GetLastError() ? ENOENT : EIO;
     }
 
-    counts_limit = be32toh(encoding_flyweight.payload_len);
-    lowest_trackable_value = be64toh(encoding_flyweight.lowest_trackable_value);
-    highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
-    significant_figures = be32toh(encoding_flyweight.significant_figures);
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        CloseHandle(file);
+        return EIO;
+    }
 
-    rc = hdr_init(lowest_trackable_value, highest_trackable_value, significant_figures, &h);
-    if (rc)
+    /* Empty files can not be mapped, they read as an empty log. */
+    if (0 < file_size.QuadPart)
     {
-        FAIL_AND_CLEANUP(cleanup, result, rc);
+        if ((uint64_t) file_size.QuadPart > (uint64_t) SIZE_MAX)
+        {
+            CloseHandle(file);
+            return ENOMEM;
+        }
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (NULL != mapping)
+        {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+
+        if (NULL == view)
+        {
+            CloseHandle(file);
+            return ENOMEM;
+        }
     }
 
-    /* Make sure there at least 9 bytes to read */
-    /* if there is a corrupt value at the end */
-    /* of the array we won't read corrupt data or crash. */
-    if ((counts_array = calloc(1, (size_t) counts_limit + 9)) == NULL)
+    CloseHandle(file);
+
+    *data = (const char*) view;
+    *length = (size_t) file_size.QuadPart;
+
+    return 0;
+}
+
+static void log_file_unmap(const char* data, size_t length)
+{
+    (void)length;
+
+    if (NULL != data)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        UnmapViewOfFile(data);
     }
+}
+
+#else
 
-    strm.next_out = counts_array;
-    strm.avail_out = (uInt) counts_limit;
+static int log_file_map(const char* path, const char** data, size_t* length)
+{
+    struct stat st;
+    void* addr = NULL;
+    int fd = open(path, O_RDONLY);
+    int rc = 0;
+
+    if (fd < 0)
+    {
+        return errno;
+    }
 
-    if (inflate(&strm, Z_FINISH) != Z_STREAM_END)
+    /* Empty files can not be mapped, they read as an empty log. */
+    if (fstat(fd, &st) != 0)
+    {
+        rc = errno;
+    }
+    else if ((off_t) (size_t) st.st_size != st.st_size)
+    {
+        rc = ENOMEM;
+    }
+    else if (0 < st.st_size && MAP_FAILED == (addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)))
     {
-        FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
+        rc = errno;
     }
 
-    rc = _apply_to_counts_zz(h, counts_array, counts_limit);
+    close(fd);
+
     if (rc)
     {
-        FAIL_AND_CLEANUP(cleanup, result, rc);
+        return rc;
     }
 
-    h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
-    h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
-    hdr_reset_internal_counters(h);
+#if defined(MADV_SEQUENTIAL)
+    if (NULL != addr)
+    {
+        madvise(addr, (size_t) st.st_size, MADV_SEQUENTIAL);
+    }
+#endif
 
-cleanup:
-    (void)inflateEnd(&strm);
-    free(counts_array);
+    *data = (const char*) addr;
+    *length = (size_t) st.st_size;
 
-    if (result != 0)
+    return 0;
+}
+
+static void log_file_unmap(const char* data, size_t length)
+{
+    if (NULL != data)
     {
-        free(h);
+        munmap((void*) data, length);
     }
-    else if (NULL == *histogram)
+}
+
+#endif
+
+/* Finds the line of the mapped log at position, without its trailing whitespace, */
+/* and moves position to the start of the next line.                            */
+static bool mapped_next_line(
+    const char* data, size_t length, size_t* position, const char** line, const char** end)
+{
+    const char* start = data + *position;
+    size_t remaining = length - *position;
+    const char* newline;
+
+    if (0 == remaining)
     {
-        *histogram = h;
+        return false;
     }
-    else
+
+    newline = (const char*) memchr(start, '\n', remaining);
+    *line = start;
+    *end = NULL == newline ? start + remaining : newline;
+    *position += (size_t) (*end - start) + (NULL == newline ? 0 : 1);
+
+    while (*line < *end && isspace((unsigned char) (*end)[-1]))
     {
-        hdr_add(*histogram, h);
-        free(h);
+        (*end)--;
     }
 
-    return result;
+    return true;
 }
 
-int hdr_decode_compressed(
-    uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+int hdr_log_mmap_reader_open(struct hdr_log_mmap_reader* reader, const char* path)
 {
-    int32_t compression_cookie;
-    _compression_flyweight* compression_flyweight;
+    const char* line;
+    const char* end;
+    int rc;
 
-    if (length < SIZEOF_COMPRESSION_FLYWEIGHT)
+    hdr_log_reader_init(&reader->reader);
+    reader->data = NULL;
+    reader->length = 0;
+    reader->position = 0;
+    reader->compressed = NULL;
+    reader->compressed_capacity = 0;
+
+    if ((rc = log_file_map(path, &reader->data, &reader->length)) != 0)
     {
-        return EINVAL;
+        return rc;
     }
 
-    compression_flyweight = (_compression_flyweight*) buffer;
-
-    compression_cookie = get_cookie_base(be32toh(compression_flyweight->cookie));
-    if (V0_COMPRESSION_COOKIE == compression_cookie)
+    /* The header is the comment lines up to and including the CSV legend. */
+    while (reader->position < reader->length)
     {
-        return hdr_decode_compressed_v0(compression_flyweight, length, histogram);
+        char c = reader->data[reader->position];
+
+        if ('#' != c && '"' != c)
+        {
+            break;
+        }
+
+        mapped_next_line(reader->data, reader->length, &reader->position, &line, &end);
+
+        if ('"' == c)
+        {
+            break;
+        }
+
+        scan_header_line(&reader->reader, line, end);
     }
-    else if (V1_COMPRESSION_COOKIE == compression_cookie)
+
+    if (!validate_log_version(&reader->reader))
     {
-        return hdr_decode_compressed_v1(compression_flyweight, length, histogram);
+        FAIL_AND_CLEANUP(cleanup, rc, HDR_LOG_INVALID_VERSION);
     }
-    else if (V2_COMPRESSION_COOKIE == compression_cookie)
+
+    rc = hdr_decoder_init(&reader->reader.decoder);
+
+cleanup:
+    if (rc)
     {
-        return hdr_decode_compressed_v2(compression_flyweight, length, histogram);
+        hdr_log_mmap_reader_close(reader);
     }
 
-    return HDR_COMPRESSION_COOKIE_MISMATCH;
+    return rc;
 }
 
-/* ##      ## ########  #### ######## ######## ########  */
-/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
-/* ##  ##  ## ##     ##  ##     ##    ##       ##     ## */
-/* ##  ##  ## ########   ##     ##    ######   ########  */
-/* ##  ##  ## ##   ##    ##     ##    ##       ##   ##   */
-/* ##  ##  ## ##    ##   ##     ##    ##       ##    ##  */
-/*  ###  ###  ##     ## ####    ##    ######## ##     ## */
-
-int hdr_log_writer_init(struct hdr_log_writer* writer)
+void hdr_log_mmap_reader_close(struct hdr_log_mmap_reader* reader)
 {
-    (void)writer;
-    return 0;
+    log_file_unmap(reader->data, reader->length);
+    free(reader->compressed);
+    hdr_log_reader_close(&reader->reader);
+
+    reader->data = NULL;
+    reader->length = 0;
+    reader->position = 0;
+    reader->compressed = NULL;
+    reader->compressed_capacity = 0;
 }
 
-#define LOG_VERSION "1.2"
-#define LOG_MAJOR_VERSION 1
+int hdr_log_mmap_next(struct hdr_log_mmap_reader* reader, struct hdr_log_entry* entry)
+{
+    const char* line;
+    const char* end;
 
-static int print_user_prefix(FILE* f, const char* prefix)
+    if (!mapped_next_line(reader->data, reader->length, &reader->position, &line, &end) || line == end)
+    {
+        return EOF;
+    }
+
+    return parse_interval_line(line, end, entry) ? 0 : EINVAL;
+}
+
+int hdr_log_mmap_next_filtered(
+    struct hdr_log_mmap_reader* reader, const struct hdr_log_filter* filter, struct hdr_log_entry* entry)
 {
-    if (!prefix)
+    int rc;
+
+    while ((rc = hdr_log_mmap_next(reader, entry)) == 0 && !hdr_log_filter_matches(filter, entry))
     {
-        return 0;
+        rc = log_reader_skip(&reader->reader, filter, entry, &reader->compressed, &reader->compressed_capacity);
+        if (rc)
+        {
+            return rc;
+        }
     }
 
-    return fprintf(f, "#[%s]\n", prefix);
+    return rc;
 }
 
-static int print_version(FILE* f, const char* version)
+int hdr_log_mmap_decode(
+    struct hdr_log_mmap_reader* reader, const struct hdr_log_entry* entry, struct hdr_histogram** histogram)
 {
-    return fprintf(f, "#[Histogram log format version %s]\n", version);
+    return log_reader_decode_base64(
+        &reader->reader, entry, &reader->compressed, &reader->compressed_capacity, histogram);
 }
 
-static int print_time(FILE* f, hdr_timespec* timestamp)
+int hdr_log_mmap_read(
+    struct hdr_log_mmap_reader* reader, struct hdr_histogram** histogram,
+    hdr_timespec* timestamp, hdr_timespec* interval)
 {
-    char time_str[128];
-    struct tm date_time;
+    struct hdr_log_entry entry;
+    int rc;
 
-    if (!timestamp)
+    if ((rc = hdr_log_mmap_next(reader, &entry)) != 0 ||
+        (rc = hdr_log_mmap_decode(reader, &entry, histogram)) != 0)
     {
-        return 0;
+        return rc;
     }
 
-#if defined(__WINDOWS__)
-    _gmtime32_s(&date_time, &timestamp->tv_sec);
-#else
-    gmtime_r(&timestamp->tv_sec, &date_time);
-#endif
+    if (NULL != timestamp)
+    {
+        *timestamp = entry.timestamp;
+    }
+    if (NULL != interval)
+    {
+        *interval = entry.interval;
+    }
 
-    strftime(time_str, 128, "%a %b %X %Z %Y", &date_time);
+    return 0;
+}
 
-    return fprintf(
-        f, "#[StartTime: %.3f (seconds since epoch), %s]\n",
-        hdr_timespec_as_double(timestamp), time_str);
+/* One thread of hdr_log_mmap_process, decoding the entries that start within */
+/* [begin, end) of the mapped log with its own decoder and scratch buffer.     */
+struct log_worker
+{
+    hdr_thread thread;
+    const struct hdr_log_mmap_reader* source;
+    size_t begin;
+    size_t end;
+    hdr_log_target_fn target;
+    void* accumulator;
+    struct hdr_log_reader reader;
+    uint8_t* compressed;
+    size_t compressed_capacity;
+    int result;
+};
+
+static void log_worker_run(void* arg)
+{
+    struct log_worker* worker = (struct log_worker*) arg;
+    const char* data = worker->source->data;
+    size_t position = worker->begin;
+    struct hdr_log_entry entry;
+    struct hdr_histogram** histogram;
+    const char* line;
+    const char* end;
+
+    /* A line that straddles begin belongs to the previous worker. */
+    if (position > worker->source->position && '\n' != data[position - 1])
+    {
+        mapped_next_line(data, worker->source->length, &position, &line, &end);
+    }
+
+    while (position < worker->end &&
+        mapped_next_line(data, worker->source->length, &position, &line, &end))
+    {
+        if (line == end)
+        {
+            continue;
+        }
+
+        if (!parse_interval_line(line, end, &entry))
+        {
+            worker->result = EINVAL;
+            return;
+        }
+
+        if ((histogram = worker->target(worker->accumulator, &entry)) == NULL)
+        {
+            continue;
+        }
+
+        worker->result = log_reader_decode_base64(
+            &worker->reader, &entry, &worker->compressed, &worker->compressed_capacity, histogram);
+        if (worker->result)
+        {
+            return;
+        }
+    }
 }
 
-static int print_header(FILE* f)
-{
-    return fprintf(f, "\"StartTimestamp\",\"EndTimestamp\",\"Interval_Max\",\"Interval_Compressed_Histogram\"\n");
+/* Delta encoded entries depend on the ones before them, so they are decoded in */
+/* order on the calling thread, continuing the delta chains of any entries     */
+/* already read from the reader.  Entries the target skips are still applied.  */
+static int log_mmap_process_deltas(struct hdr_log_mmap_reader* reader, hdr_log_target_fn target, void* accumulator)
+{
+    struct hdr_log_entry entry;
+    const char* line;
+    const char* end;
+    int rc;
+
+    while (mapped_next_line(reader->data, reader->length, &reader->position, &line, &end))
+    {
+        if (line == end)
+        {
+            continue;
+        }
+
+        if (!parse_interval_line(line, end, &entry))
+        {
+            return EINVAL;
+        }
+
+        rc = log_reader_decode_base64(
+            &reader->reader, &entry, &reader->compressed, &reader->compressed_capacity,
+            target(accumulator, &entry));
+        if (rc)
+        {
+            return rc;
+        }
+    }
+
+    return 0;
 }
 
-/* Example log                                                                       */
-/* #[Logged with jHiccup version 2.0.3-SNAPSHOT]                                     */
-/* #[Histogram log format version 1.01]                                              */
-/* #[StartTime: 1403476110.183 (seconds since epoch), Mon Jun 23 10:28:30 NZST 2014] */
-/* "StartTimestamp","EndTimestamp","Interval_Max","Interval_Compressed_Histogram"    */
-int hdr_log_write_header(
-    struct hdr_log_writer* writer, FILE* file,
-    const char* user_prefix, hdr_timespec* timestamp)
+int hdr_log_mmap_process(
+    struct hdr_log_mmap_reader* reader, int32_t threads, hdr_log_target_fn target, void** accumulators)
 {
-    (void)writer;
+    struct log_worker* workers;
+    size_t remaining = reader->length - reader->position;
+    int32_t started = 0;
+    int32_t i;
+    int result = 0;
 
-    if (print_user_prefix(file, user_prefix) < 0)
-    {
-        return EIO;
-    }
-    if (print_version(file, LOG_VERSION) < 0)
+    if (threads < 1)
     {
-        return EIO;
+        return EINVAL;
     }
-    if (print_time(file, timestamp) < 0)
+
+    if (reader->reader.keyframe_interval > 0)
     {
-        return EIO;
+        return log_mmap_process_deltas(reader, target, accumulators[0]);
     }
-    if (print_header(file) < 0)
+
+    if ((workers = (struct log_worker*) calloc((size_t) threads, sizeof(struct log_worker))) == NULL)
     {
-        return EIO;
+        return ENOMEM;
     }
 
-    return 0;
-}
+    for (i = 0; i < threads; i++)
+    {
+        struct log_worker* worker = &workers[i];
 
-int hdr_log_write(
-    struct hdr_log_writer* writer,
-    FILE* file,
-    const hdr_timespec* start_timestamp,
-    const hdr_timespec* end_timestamp,
-    struct hdr_histogram* histogram)
-{
-    uint8_t* compressed_histogram = NULL;
-    size_t compressed_len = 0;
-    char* encoded_histogram = NULL;
-    int rc = 0;
-    int result = 0;
-    size_t encoded_len;
+        worker->source = reader;
+        worker->begin = reader->position + (size_t) ((double) remaining * i / threads);
+        worker->end = reader->position + (size_t) ((double) remaining * (i + 1) / threads);
+        worker->target = target;
+        worker->accumulator = accumulators[i];
+        hdr_log_reader_init(&worker->reader);
 
-    (void)writer;
+        if ((result = hdr_decoder_init(&worker->reader.decoder)) != 0)
+        {
+            break;
+        }
+    }
+    workers[threads - 1].end = reader->length;
 
-    rc = hdr_encode_compressed(histogram, &compressed_histogram, &compressed_len);
-    if (rc != 0)
+    /* The calling thread takes the first range itself. */
+    for (i = 1; 0 == result && i < threads; i++, started++)
     {
-        FAIL_AND_CLEANUP(cleanup, result, rc);
+        if (hdr_thread_create(&workers[i].thread, log_worker_run, &workers[i]) != 0)
+        {
+            result = EAGAIN;
+            break;
+        }
     }
 
-    encoded_len = hdr_base64_encoded_len(compressed_len);
-    encoded_histogram = calloc(encoded_len + 1, sizeof(char));
+    if (0 == result)
+    {
+        log_worker_run(&workers[0]);
+    }
 
-    rc = hdr_base64_encode(
-        compressed_histogram, compressed_len, encoded_histogram, encoded_len);
-    if (rc != 0)
+    for (i = 1; i <= started; i++)
     {
-        FAIL_AND_CLEANUP(cleanup, result, rc);
+        hdr_thread_join(&workers[i].thread);
     }
 
-    if (fprintf(
-        file, "%.3f,%.3f,%"PRIu64".0,%s\n",
-        hdr_timespec_as_double(start_timestamp),
-        hdr_timespec_as_double(end_timestamp),
-        hdr_max(histogram),
-        encoded_histogram) < 0)
+    for (i = 0; i < threads; i++)
     {
-        result = EIO;
+        result = 0 == result ? workers[i].result : result;
+        free(workers[i].compressed);
+        hdr_log_reader_close(&workers[i].reader);
     }
 
-cleanup:
-    free(compressed_histogram);
-    free(encoded_histogram);
+    free(workers);
+    reader->position = reader->length;
 
     return result;
 }
 
-/* ########  ########    ###    ########  ######## ########  */
-/* ##     ## ##         ## ##   ##     ## ##       ##     ## */
-/* ##     ## ##        ##   ##  ##     ## ##       ##     ## */
-/* ########  ######   ##     ## ##     ## ######   ########  */
-/* ##   ##   ##       ######### ##     ## ##       ##   ##   */
-/* ##    ##  ##       ##     ## ##     ## ##       ##    ##  */
-/* ##     ## ######## ##     ## ########  ######## ##     ## */
-
-int hdr_log_reader_init(struct hdr_log_reader* reader)
-{
-    reader->major_version = 0;
-    reader->minor_version = 0;
-    reader->start_timestamp.tv_sec = 0;
-    reader->start_timestamp.tv_nsec = 0;
-
-    return 0;
-}
-
-static void scan_log_format(struct hdr_log_reader* reader, const char* line)
+static struct hdr_histogram** merge_target(void* accumulator, const struct hdr_log_entry* entry)
 {
-    const char* format = "#[Histogram log format version %d.%d]";
-    sscanf(line, format, &reader->major_version, &reader->minor_version);
+    (void)entry;
+    return (struct hdr_histogram**) accumulator;
 }
 
-static void scan_start_time(struct hdr_log_reader* reader, const char* line)
+int hdr_log_mmap_merge(struct hdr_log_mmap_reader* reader, int32_t threads, struct hdr_histogram** histogram)
 {
-    const char* format = "#[StartTime: %lf [^\n]";
-    double timestamp = 0.0;
+    struct hdr_histogram** partials;
+    void** accumulators;
+    int32_t i;
+    int rc;
 
-    if (sscanf(line, format, &timestamp) == 1)
+    if (threads < 1)
     {
-        hdr_timespec_from_double(&reader->start_timestamp, timestamp);
+        return EINVAL;
     }
-}
-
-static void scan_header_line(struct hdr_log_reader* reader, const char* line)
-{
-    scan_log_format(reader, line);
-    scan_start_time(reader, line);
-}
-
-static bool validate_log_version(struct hdr_log_reader* reader)
-{
-    return reader->major_version == LOG_MAJOR_VERSION &&
-        (reader->minor_version == 0 || reader->minor_version == 1 ||
-            reader->minor_version == 2 || reader->minor_version == 3);
-}
 
-#define HEADER_LINE_LENGTH 128
-
-int hdr_log_read_header(struct hdr_log_reader* reader, FILE* file)
-{
-    char line[HEADER_LINE_LENGTH]; /* TODO: check for overflow. */
+    partials = (struct hdr_histogram**) calloc((size_t) threads, sizeof(struct hdr_histogram*));
+    accumulators = (void**) calloc((size_t) threads, sizeof(void*));
+    if (NULL == partials || NULL == accumulators)
+    {
+        FAIL_AND_CLEANUP(cleanup, rc, ENOMEM);
+    }
 
-    bool parsing_header = true;
+    for (i = 0; i < threads; i++)
+    {
+        accumulators[i] = &partials[i];
+    }
 
-    do
+    if ((rc = hdr_log_mmap_process(reader, threads, merge_target, accumulators)) != 0)
     {
-        int c = fgetc(file);
-        ungetc(c, file);
+        goto cleanup;
+    }
 
-        switch (c)
+    for (i = 0; i < threads; i++)
+    {
+        if (NULL == partials[i])
         {
+            continue;
+        }
 
-        case '#':
-            if (fgets(line, HEADER_LINE_LENGTH, file) == NULL)
-            {
-                return EIO;
-            }
-
-            scan_header_line(reader, line);
-            break;
-
-        case '"':
-            if (fgets(line, HEADER_LINE_LENGTH, file) == NULL)
-            {
-                return EIO;
-            }
-
-            parsing_header = false;
-            break;
-
-        default:
-            parsing_header = false;
+        if (NULL == *histogram)
+        {
+            *histogram = partials[i];
+            partials[i] = NULL;
+        }
+        else
+        {
+            hdr_add(*histogram, partials[i]);
         }
     }
-    while (parsing_header);
 
-    if (!validate_log_version(reader))
+cleanup:
+    for (i = 0; NULL != partials && i < threads; i++)
     {
-        return HDR_LOG_INVALID_VERSION;
+        if (NULL != partials[i])
+        {
+            hdr_close(partials[i]);
+        }
     }
+    free(partials);
+    free(accumulators);
 
-    return 0;
+    return rc;
 }
 
-static void update_timespec(hdr_timespec* ts, double timestamp)
+/* ########   #######  ##       ##       ##     ## ########  */
+/* ##     ## ##     ## ##       ##       ##     ## ##     ## */
+/* ##     ## ##     ## ##       ##       ##     ## ##     ## */
+/* ########  ##     ## ##       ##       ##     ## ########  */
+/* ##   ##   ##     ## ##       ##       ##     ## ##        */
+/* ##    ##  ##     ## ##       ##       ##     ## ##        */
+/* ##     ##  #######  ######## ########  #######  ##        */
+
+/* The coarser interval being merged for one tag. */
+struct log_rollup
 {
-    if (NULL == ts)
-    {
-        return;
-    }
+    char* tag;
+    struct hdr_histogram* histogram;
+    hdr_timespec start_timestamp;
+    hdr_timespec end_timestamp;
+    int64_t window;
+    int32_t intervals;
+    struct log_rollup* next;
+};
 
-    hdr_timespec_from_double(ts, timestamp);
+static int64_t timespec_as_nanos(const hdr_timespec* t)
+{
+    return (int64_t) t->tv_sec * 1000000000 + (int64_t) t->tv_nsec;
 }
 
-#if defined(_MSC_VER)
+static bool timespec_before(const hdr_timespec* a, const hdr_timespec* b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
 
-static ssize_t hdr_read_chunk(char* buffer, size_t length, char terminator, FILE* stream)
+static int log_rollup_for(struct log_rollup** rollups, const struct hdr_log_entry* entry, struct log_rollup** result)
 {
-    if (buffer == NULL || length == 0)
+    struct log_rollup* rollup;
+
+    /* New tags are appended, keeping the list in first seen order. */
+    for (; NULL != *rollups; rollups = &(*rollups)->next)
     {
-        return -1;
+        if (tag_equals((*rollups)->tag, entry->tag, entry->tag_len))
+        {
+            *result = *rollups;
+            return 0;
+        }
     }
 
-    for (size_t i = 0; i < length; ++i)
+    if ((rollup = (struct log_rollup*) calloc(1, sizeof(struct log_rollup))) == NULL)
     {
-        int c = fgetc(stream);
-        buffer[i] = (char)c;
-        if (c == (int) '\0' || c == (int) terminator || c == EOF)
+        return ENOMEM;
+    }
+
+    if (NULL != entry->tag)
+    {
+        if ((rollup->tag = (char*) malloc(entry->tag_len + 1)) == NULL)
         {
-            buffer[i] = '\0';
-            return i;
+            free(rollup);
+            return ENOMEM;
         }
+
+        memcpy(rollup->tag, entry->tag, entry->tag_len);
+        rollup->tag[entry->tag_len] = '\0';
     }
 
-    return length;
+    *rollups = rollup;
+    *result = rollup;
+
+    return 0;
 }
 
-/* Note that this version of getline assumes lineptr is valid. */
-static ssize_t hdr_getline(char** lineptr, FILE* stream)
+/* Writes the merged interval, keeping its histogram for the next one. */
+static int log_rollup_flush(struct hdr_log_writer* writer, FILE* output, struct log_rollup* rollup)
 {
-    if (stream == NULL)
+    int rc;
+
+    if (0 == rollup->intervals)
     {
-        return -1;
+        return 0;
     }
 
-    size_t allocation = 128;
-    size_t used = 0;
+    rc = hdr_log_write_tagged(
+        writer, output, rollup->tag, &rollup->start_timestamp, &rollup->end_timestamp, rollup->histogram);
+
+    hdr_reset(rollup->histogram);
+    rollup->intervals = 0;
+
+    return rc;
+}
+
+/* Writes the open intervals whose window is before 'window', or all of them */
+/* when it is NULL, earliest first so that the output stays in timestamp     */
+/* order across tags.                                                        */
+static int log_rollups_flush(
+    struct hdr_log_writer* writer, FILE* output, struct log_rollup* rollups, const int64_t* window)
+{
+    struct log_rollup* rollup;
+    int rc;
 
-    char* scratch = NULL;
     for (;;)
     {
-        allocation += allocation;
+        struct log_rollup* earliest = NULL;
 
-        char* before = scratch;
-        scratch = realloc(scratch, allocation);
-        if (scratch == NULL)
+        for (rollup = rollups; NULL != rollup; rollup = rollup->next)
         {
-            if (before)
+            if (0 < rollup->intervals && (NULL == window || rollup->window < *window) &&
+                (NULL == earliest || timespec_before(&rollup->start_timestamp, &earliest->start_timestamp)))
             {
-                free(before);
+                earliest = rollup;
             }
-            return -1;
         }
 
-        size_t wanted = allocation - used - 1;
-        size_t read_length = hdr_read_chunk(scratch + used, wanted, '\n', stream);
-        used += read_length;
-
+        if (NULL == earliest)
+        {
+            return 0;
+        }
 
-        if (read_length < wanted || scratch[used - 1] == '\n' || scratch[used - 1] == '\0')
+        if ((rc = log_rollup_flush(writer, output, earliest)) != 0)
         {
-            scratch[used] = '\0';
-            *lineptr = scratch;
-            return used;
+            return rc;
         }
     }
 }
 
-#else
-static ssize_t hdr_getline(char** lineptr, FILE* stream)
-{
-    size_t line_length = 0;
-    return getline(lineptr, &line_length, stream);
-}
-#endif
-
-int hdr_log_read(
-    struct hdr_log_reader* reader, FILE* file, struct hdr_histogram** histogram,
-    hdr_timespec* timestamp, hdr_timespec* interval)
+int hdr_log_rollup(FILE* input, FILE* output, int32_t intervals, const hdr_timespec* period)
 {
-    const char* format_v12 = "%lf,%lf,%d.%d,%s";
-    const char* format_v13 = "Tag=%*[^,],%lf,%lf,%d.%d,%s";
-    char* base64_histogram = NULL;
-    uint8_t* compressed_histogram = NULL;
-    char* line = NULL;
-    int result = 0;
-    ssize_t read;
-    size_t base64_len, compressed_len;
-    int r;
-    int interval_max_s = 0;
-    int interval_max_ms = 0;
-    int num_tokens;
-
-    double begin_timestamp = 0.0;
-    double end_timestamp = 0.0;
+    struct hdr_log_reader reader;
+    struct hdr_log_writer writer;
+    struct hdr_log_entry entry;
+    struct log_rollup* rollups = NULL;
+    struct log_rollup* rollup;
+    int64_t period_ns = NULL == period ? 0 : timespec_as_nanos(period);
+    int rc;
 
-    (void)reader;
-
-    read = hdr_getline(&line, file);
-    if (-1 == read)
+    if ((0 < intervals) == (NULL != period) || (NULL != period && period_ns <= 0))
     {
-        if (0 == errno)
-        {
-            FAIL_AND_CLEANUP(cleanup, result, EOF);
-        }
-        else
-        {
-            FAIL_AND_CLEANUP(cleanup, result, EIO);
-        }
+        return EINVAL;
     }
 
-    null_trailing_whitespace(line, read);
-    if (strlen(line) == 0)
-    {
-        FAIL_AND_CLEANUP(cleanup, result, EOF);
-    }
+    hdr_log_reader_init(&reader);
+    hdr_log_writer_init(&writer);
 
-    r = realloc_buffer((void**)&base64_histogram, sizeof(char), read);
-    if (r != 0)
+    if ((rc = hdr_log_read_header(&reader, input)) != 0 ||
+        (rc = hdr_log_write_header(&writer, output, NULL, &reader.start_timestamp)) != 0)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+        goto cleanup;
     }
 
-    r = realloc_buffer((void**)&compressed_histogram, sizeof(uint8_t), read);
-    if (r != 0)
+    /* Each entry is decoded straight into the histogram of its tag's interval. */
+    while ((rc = log_read_entry(&reader, input, &entry)) == 0)
     {
-        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
-    }
+        int64_t window = 0;
 
-    num_tokens = sscanf(
-            line, format_v13, &begin_timestamp, &end_timestamp,
-            &interval_max_s, &interval_max_ms, base64_histogram);
+        if (0 < period_ns)
+        {
+            int64_t nanos = timespec_as_nanos(&entry.timestamp);
+            window = nanos / period_ns - (nanos % period_ns < 0 ? 1 : 0);
 
-    if (num_tokens != 5)
-    {
-        num_tokens = sscanf(
-            line, format_v12, &begin_timestamp, &end_timestamp,
-            &interval_max_s, &interval_max_ms, base64_histogram);
+            /* Windows of any tag that ended before this entry are complete. */
+            if ((rc = log_rollups_flush(&writer, output, rollups, &window)) != 0)
+            {
+                goto cleanup;
+            }
+        }
 
-        if (num_tokens != 5)
+        if ((rc = log_rollup_for(&rollups, &entry, &rollup)) != 0)
         {
-            FAIL_AND_CLEANUP(cleanup, result, EINVAL);
+            goto cleanup;
         }
-    }
 
-    base64_len = strlen(base64_histogram);
-    compressed_len = hdr_base64_decoded_len(base64_len);
+        if (0 < period_ns && 0 < rollup->intervals && window != rollup->window &&
+            (rc = log_rollup_flush(&writer, output, rollup)) != 0)
+        {
+            goto cleanup;
+        }
 
-    r = hdr_base64_decode(
-        base64_histogram, base64_len, compressed_histogram, compressed_len);
+        if (0 == rollup->intervals)
+        {
+            rollup->start_timestamp = entry.timestamp;
+            rollup->end_timestamp = entry.interval;
+            rollup->window = window;
+        }
 
-    if (r != 0)
-    {
-        FAIL_AND_CLEANUP(cleanup, result, r);
+        rc = log_reader_decode_base64(
+            &reader, &entry, &reader.compressed, &reader.compressed_capacity, &rollup->histogram);
+        if (rc)
+        {
+            goto cleanup;
+        }
+
+        if (timespec_before(&rollup->end_timestamp, &entry.interval))
+        {
+            rollup->end_timestamp = entry.interval;
+        }
+
+        if (++rollup->intervals == intervals && (rc = log_rollup_flush(&writer, output, rollup)) != 0)
+        {
+            goto cleanup;
+        }
     }
 
-    r = hdr_decode_compressed(compressed_histogram, compressed_len, histogram);
-    if (r != 0)
+    if (EOF != rc)
     {
-        FAIL_AND_CLEANUP(cleanup, result, r);
+        goto cleanup;
     }
 
-    update_timespec(timestamp, begin_timestamp);
-    update_timespec(interval, end_timestamp);
+    rc = log_rollups_flush(&writer, output, rollups, NULL);
 
 cleanup:
-    free(line);
-    free(base64_histogram);
-    free(compressed_histogram);
+    while (NULL != rollups)
+    {
+        rollup = rollups->next;
+        if (NULL != rollups->histogram)
+        {
+            hdr_close(rollups->histogram);
+        }
+        free(rollups->tag);
+        free(rollups);
+        rollups = rollup;
+    }
 
-    return result;
+    hdr_log_reader_close(&reader);
+    hdr_log_writer_close(&writer);
+
+    return rc;
 }
 
 int hdr_log_encode(struct hdr_histogram* histogram, char** encoded_histogram)
 {
-    char *encoded_histogram_tmp = NULL;
-    uint8_t* compressed_histogram = NULL;
-    size_t compressed_len = 0;
-    int rc = 0;
-    int result = 0;
+    struct hdr_encoder* encoder;
+    const uint8_t* compressed;
+    size_t compressed_len;
     size_t encoded_len;
+    char* encoded_histogram_tmp = NULL;
+    int rc;
+    int result = 0;
 
-    rc = hdr_encode_compressed(histogram, &compressed_histogram, &compressed_len);
-    if (rc != 0)
+    if ((rc = hdr_encoder_init(&encoder)) != 0)
+    {
+        return rc;
+    }
+
+    /* Compressing into the encoder first sizes the result to the encoded */
+    /* histogram rather than to hdr_log_encode_bound.                     */
+    if ((rc = hdr_encoder_encode(encoder, histogram, &compressed, &compressed_len)) != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, rc);
     }
 
     encoded_len = hdr_base64_encoded_len(compressed_len);
-    encoded_histogram_tmp = calloc(encoded_len + 1, sizeof(char));
+    if ((encoded_histogram_tmp = (char*) malloc(encoded_len + 1)) == NULL)
+    {
+        FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
+    }
 
-    rc = hdr_base64_encode(
-        compressed_histogram, compressed_len, encoded_histogram_tmp, encoded_len);
-    if (rc != 0)
+    if ((rc = hdr_base64_encode(compressed, compressed_len, encoded_histogram_tmp, encoded_len)) != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, rc);
     }
 
+    encoded_histogram_tmp[encoded_len] = '\0';
     *encoded_histogram = encoded_histogram_tmp;
+    encoded_histogram_tmp = NULL;
 
 cleanup:
-    free(compressed_histogram);
+    free(encoded_histogram_tmp);
+    hdr_encoder_close(encoder);
 
     return result;
 }
@@ -20,6 +20,10 @@
 #define HDR_TRAILING_ZEROS_INVALID -29992
 #define HDR_VALUE_TRUNCATED -29991
 #define HDR_ENCODED_INPUT_TOO_LONG -29990
+#define HDR_LOG_DELTA_WITHOUT_KEYFRAME -29989
+
+#define HDR_CODEC_DEFLATE 0
+#define HDR_CODEC_STORED 1
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -42,9 +46,269 @@ int hdr_log_encode(struct hdr_histogram* histogram, char** encoded_histogram);
  */
 int hdr_log_decode(struct hdr_histogram** histogram, char* base64_histogram, size_t base64_len);
 
+/**
+ * Reusable state for encoding histograms: a deflate stream that is reset
+ * rather than initialised for every histogram, plus scratch buffers for the
+ * encoded counts.  An encoder must not be used by more than one thread at a time.
+ */
+struct hdr_encoder;
+
+/**
+ * Allocate and initialise an encoder.
+ *
+ * @param encoder Output parameter to capture the allocated encoder.
+ * @return 0 on success, ENOMEM if malloc failed, HDR_DEFLATE_INIT_FAIL if zlib
+ * could not be initialised.
+ */
+int hdr_encoder_init(struct hdr_encoder** encoder);
+
+/**
+ * Select how the encoder compresses histograms, the codec is recorded in the
+ * compression cookie so decoders pick it up automatically.  HDR_CODEC_DEFLATE
+ * is the default and the only codec other HdrHistogram implementations read,
+ * level ranges from Z_DEFAULT_COMPRESSION (-1) to Z_BEST_COMPRESSION (9).
+ * HDR_CODEC_STORED frames the encoded histogram without compressing it, which
+ * suits short lived histograms passed between processes on the same host, the
+ * level is ignored.
+ *
+ * @param encoder 'This' pointer
+ * @param codec HDR_CODEC_DEFLATE or HDR_CODEC_STORED.
+ * @param level The deflate compression level.
+ * @return 0 on success, EINVAL if the codec or level is invalid,
+ * HDR_DEFLATE_FAIL if the deflate level could not be changed.
+ */
+int hdr_encoder_set_codec(struct hdr_encoder* encoder, int codec, int level);
+
+/**
+ * Select the counts encoding.  Version 2, the default, writes LEB128 ZigZag
+ * encoded counts and is read by every HdrHistogram implementation.  Version 3
+ * writes runs of equal counts and blocks of bit packed counts, which is
+ * smaller and much faster to decode for dense histograms, and carries the
+ * total count and maximum value in its header; only this library reads it.
+ * Entries of delta encoded logs other than keyframes are always version 2.
+ *
+ * @param encoder 'This' pointer
+ * @param version 2 or 3.
+ * @return 0 on success, EINVAL if the version is not supported.
+ */
+int hdr_encoder_set_version(struct hdr_encoder* encoder, int32_t version);
+
+/**
+ * Free the encoder and all of its buffers.
+ *
+ * @param encoder The encoder to free, may be NULL.
+ */
+void hdr_encoder_close(struct hdr_encoder* encoder);
+
+/**
+ * Encode and compress the histogram in the same binary format as
+ * hdr_log_encode before base64 encoding it.  The result is held in a buffer
+ * owned by the encoder and is only valid until the next call using it.
+ *
+ * @param encoder 'This' pointer
+ * @param histogram The histogram to encode.
+ * @param compressed_histogram Output parameter to capture the encoded histogram.
+ * @param compressed_len Output parameter to capture the length of the encoded histogram.
+ * @return 0 on success, ENOMEM if a buffer could not be grown, HDR_DEFLATE_FAIL
+ * if compression failed.
+ */
+int hdr_encoder_encode(
+    struct hdr_encoder* encoder,
+    const struct hdr_histogram* histogram,
+    const uint8_t** compressed_histogram,
+    size_t* compressed_len);
+
+/**
+ * Encode and compress the histogram directly into the supplied buffer.
+ *
+ * @param encoder 'This' pointer
+ * @param histogram The histogram to encode.
+ * @param buffer The buffer to write the encoded histogram to.
+ * @param capacity The size of buffer, hdr_encode_compressed_bound(histogram)
+ * bytes is always enough.
+ * @param compressed_len Output parameter to capture the length of the encoded histogram.
+ * @return 0 on success, ENOBUFS if buffer is too small, ENOMEM if a scratch
+ * buffer could not be grown, HDR_DEFLATE_FAIL if compression failed.
+ */
+int hdr_encoder_encode_into(
+    struct hdr_encoder* encoder,
+    const struct hdr_histogram* histogram,
+    uint8_t* buffer,
+    size_t capacity,
+    size_t* compressed_len);
+
+/**
+ * Encode, compress and base64 encode the histogram into the supplied buffer,
+ * as a NUL terminated string in the format used by hdr_log_encode.
+ *
+ * @param encoder 'This' pointer
+ * @param histogram The histogram to encode.
+ * @param buffer The buffer to write the base64 encoded histogram to.
+ * @param capacity The size of buffer, hdr_log_encode_bound(histogram) bytes is
+ * always enough.
+ * @param encoded_len Output parameter to capture the length of the encoded
+ * histogram, excluding the NUL terminator.
+ * @return 0 on success, ENOBUFS if buffer is too small, ENOMEM if a scratch
+ * buffer could not be grown, HDR_DEFLATE_FAIL if compression failed.
+ */
+int hdr_encoder_encode_base64_into(
+    struct hdr_encoder* encoder,
+    const struct hdr_histogram* histogram,
+    char* buffer,
+    size_t capacity,
+    size_t* encoded_len);
+
+/**
+ * Get an upper bound for the size of the compressed histogram, as written by
+ * hdr_encode_compressed_into.
+ *
+ * @param histogram The histogram to be encoded.
+ * @return The maximum number of bytes the encoded histogram can take.
+ */
+size_t hdr_encode_compressed_bound(const struct hdr_histogram* histogram);
+
+/**
+ * Encode and compress the histogram into the supplied buffer, using a
+ * temporary hdr_encoder.
+ *
+ * @see hdr_encoder_encode_into
+ */
+int hdr_encode_compressed_into(
+    const struct hdr_histogram* histogram, uint8_t* buffer, size_t capacity, size_t* compressed_len);
+
+/**
+ * Get an upper bound for the size of the base64 encoded histogram, as written
+ * by hdr_log_encode_into, including the NUL terminator.
+ *
+ * @param histogram The histogram to be encoded.
+ * @return The maximum number of bytes the encoded histogram can take.
+ */
+size_t hdr_log_encode_bound(const struct hdr_histogram* histogram);
+
+/**
+ * Encode, compress and base64 encode the histogram into the supplied buffer,
+ * using a temporary hdr_encoder.
+ *
+ * @see hdr_encoder_encode_base64_into
+ */
+int hdr_log_encode_into(
+    const struct hdr_histogram* histogram, char* buffer, size_t capacity, size_t* encoded_len);
+
+/**
+ * Reusable state for decoding histograms, the decoding counterpart of
+ * hdr_encoder.  A decoder must not be used by more than one thread at a time.
+ */
+struct hdr_decoder;
+
+/**
+ * Allocate and initialise a decoder.
+ *
+ * @param decoder Output parameter to capture the allocated decoder.
+ * @return 0 on success, ENOMEM if malloc failed, HDR_INFLATE_INIT_FAIL if zlib
+ * could not be initialised.
+ */
+int hdr_decoder_init(struct hdr_decoder** decoder);
+
+/**
+ * Free the decoder and all of its buffers.
+ *
+ * @param decoder The decoder to free, may be NULL.
+ */
+void hdr_decoder_close(struct hdr_decoder* decoder);
+
+/**
+ * Decode a histogram from its compressed binary format.  If the supplied
+ * pointer to the histogram is NULL a new histogram will be allocated, which
+ * becomes the callers responsibility to free.  Otherwise the decoded values
+ * are merged into the supplied histogram.  When the supplied histogram has the
+ * same unit magnitude and significant figures as the encoded one, is unshifted
+ * and covers at least its range, the counts are added to it directly.  In that
+ * case a corrupt payload can leave part of the counts merged.  Other histograms
+ * are merged by recording the decoded values into them.
+ *
+ * @param decoder 'This' pointer
+ * @param buffer The compressed histogram.
+ * @param length The length of the compressed histogram.
+ * @param histogram Pointer to allocate a histogram to or merge into.
+ * @return 0 on success, EINVAL if the input is too short,
+ * HDR_COMPRESSION_COOKIE_MISMATCH or HDR_ENCODING_COOKIE_MISMATCH if the
+ * cookie values are incorrect, HDR_INFLATE_FAIL if decompression failed,
+ * HDR_LOG_DELTA_WITHOUT_KEYFRAME if the buffer holds a delta encoded log entry,
+ * ENOMEM if the histogram or a buffer could not be allocated.
+ */
+int hdr_decoder_decode(
+    struct hdr_decoder* decoder,
+    const uint8_t* buffer,
+    size_t length,
+    struct hdr_histogram** histogram);
+
+/**
+ * The shape of an encoded histogram, as read from its header without
+ * decompressing the counts.
+ */
+struct hdr_header_info
+{
+    /** Encoding version, 0, 1, 2 or 3. */
+    int32_t version;
+    /** HDR_CODEC_DEFLATE or HDR_CODEC_STORED. */
+    int32_t codec;
+    /** Bytes per count, 1 for the variable length counts of V2 and V3. */
+    int32_t word_size;
+    int32_t significant_figures;
+    int64_t lowest_trackable_value;
+    int64_t highest_trackable_value;
+    /** True if the counts are differences from the previous interval of a delta encoded log. */
+    bool delta;
+    /** Length of the counts once decompressed, in bytes. */
+    int32_t payload_len;
+    double conversion_ratio;
+    /** Total count of the histogram, carried by V0 and V3, -1 otherwise. */
+    int64_t total_count;
+    /** Maximum recorded value, carried by V3, -1 otherwise. */
+    int64_t max_value;
+};
+
+/**
+ * Read the header of a compressed histogram, inflating only the encoding
+ * header and none of the counts.  Cheap enough to route or filter encoded
+ * histograms by their configuration before deciding to decode them.
+ *
+ * @param decoder 'This' pointer
+ * @param buffer The compressed histogram.
+ * @param length The length of the compressed histogram.
+ * @param info Output parameter to capture the header.
+ * @return 0 on success, EINVAL if the input is too short or the header is
+ * invalid, HDR_COMPRESSION_COOKIE_MISMATCH or HDR_ENCODING_COOKIE_MISMATCH if
+ * the cookie values are incorrect, HDR_INFLATE_FAIL if decompression failed.
+ */
+int hdr_decoder_decode_header(
+    struct hdr_decoder* decoder,
+    const uint8_t* buffer,
+    size_t length,
+    struct hdr_header_info* info);
+
+/**
+ * Read the header of a compressed histogram, as hdr_decoder_decode_header,
+ * with a decoder that is created and freed for the call.
+ *
+ * @param buffer The compressed histogram.
+ * @param length The length of the compressed histogram.
+ * @param info Output parameter to capture the header.
+ * @return As hdr_decoder_decode_header, or ENOMEM or HDR_INFLATE_INIT_FAIL if
+ * the decoder could not be created.
+ */
+int hdr_decode_header(const uint8_t* buffer, size_t length, struct hdr_header_info* info);
+
+struct hdr_log_delta;
+
 struct hdr_log_writer
 {
     uint32_t nonce;
+    int32_t keyframe_interval;
+    struct hdr_encoder* encoder;
+    struct hdr_log_delta* deltas;
+    char* base64;
+    size_t base64_capacity;
 };
 
 /**
@@ -55,6 +319,32 @@ struct hdr_log_writer
  */
 int hdr_log_writer_init(struct hdr_log_writer* writer);
 
+/**
+ * Write the log as deltas: each entry stores the differences between its
+ * counts and those of the previous entry with the same tag and configuration, with a
+ * full keyframe entry every keyframe_interval entries so that readers can
+ * start from any keyframe.  Interval histograms that change little from one
+ * interval to the next encode to mostly zeros, which compress far better.
+ *
+ * Must be called before hdr_log_write_header, which announces the mode to
+ * readers.  Delta encoded logs can only be read by hdr_log_read.
+ *
+ * @param writer 'This' pointer
+ * @param keyframe_interval The number of entries between keyframes, 1 writes
+ * every entry as a keyframe.
+ * @return 0 on success, EINVAL if keyframe_interval is less than 1.
+ */
+int hdr_log_writer_enable_deltas(struct hdr_log_writer* writer, int32_t keyframe_interval);
+
+/**
+ * Free the encoder, line buffer and previous intervals held by the writer.
+ * The writer creates them with its first entry and keeps them for the entries
+ * that follow.
+ *
+ * @param writer 'This' pointer
+ */
+void hdr_log_writer_close(struct hdr_log_writer* writer);
+
 /**
  * Write the header to the log, this will constist of a user defined string,
  * the current timestamp, version information and the CSV header.
@@ -100,11 +390,47 @@ int hdr_log_write(
     const hdr_timespec* end_timestamp,
     struct hdr_histogram* histogram);
 
+/**
+ * Write an hdr_histogram entry to the log with a "Tag=<tag>," prefix, as
+ * version 1.3 of the log format, so that histograms of several sources can be
+ * written to one log and read back separately.
+ *
+ * @param writer 'This' pointer
+ * @param file The stream to write the entry to.
+ * @param tag The tag of the entry, NULL to write it untagged.
+ * @param start_timestamp The start timestamp to include in the logged entry.
+ * @param end_timestamp The end timestamp to include in the logged entry.
+ * @param histogram The histogram to encode and log.
+ * @return As hdr_log_write, or EINVAL if the tag is empty or holds a comma or
+ * whitespace.
+ */
+int hdr_log_write_tagged(
+    struct hdr_log_writer* writer,
+    FILE* file,
+    const char* tag,
+    const hdr_timespec* start_timestamp,
+    const hdr_timespec* end_timestamp,
+    struct hdr_histogram* histogram);
+
 struct hdr_log_reader
 {
     int major_version;
     int minor_version;
     hdr_timespec start_timestamp;
+    /** Non zero if the log header announced a delta encoded log. */
+    int32_t keyframe_interval;
+    struct hdr_decoder* decoder;
+    struct hdr_log_delta* deltas;
+    /** The tag of the last entry read by hdr_log_read_tagged. */
+    char* tag;
+    size_t tag_capacity;
+    /** Line and decompression buffers, freed after each read unless keep_buffers is set. */
+    char* line;
+    size_t line_capacity;
+    uint8_t* compressed;
+    size_t compressed_capacity;
+    /** Set by hdr_log_read_into: keep the decoder and buffers until hdr_log_reader_close. */
+    bool keep_buffers;
 };
 
 /**
@@ -115,6 +441,16 @@ struct hdr_log_reader
  */
 int hdr_log_reader_init(struct hdr_log_reader* reader);
 
+/**
+ * Free the decoder, previous intervals and buffers held by the reader.  Only
+ * needed for readers of delta encoded logs, readers that returned tags from
+ * hdr_log_read_tagged and readers used with hdr_log_read_into: the other reads
+ * free what they allocate before returning.
+ *
+ * @param reader 'This' pointer
+ */
+void hdr_log_reader_close(struct hdr_log_reader* reader);
+
 /**
  * Reads the the header information from the log.  Will capure information
  * such as version number and start timestamp from the header.
@@ -143,7 +479,9 @@ int hdr_log_read_header(struct hdr_log_reader* reader, FILE* file);
  * HDR_INFLATE_INIT_FAIL or HDR_INFLATE_FAIL if
  * there was a problem with Gzip.  HDR_COMPRESSION_COOKIE_MISMATCH or
  * HDR_ENCODING_COOKIE_MISMATCH if the cookie values are incorrect.
- * HDR_LOG_INVALID_VERSION if the log can not be parsed.  ENOMEM if buffer space
+ * HDR_LOG_INVALID_VERSION if the log can not be parsed.
+ * HDR_LOG_DELTA_WITHOUT_KEYFRAME if a delta encoded entry was read before a
+ * keyframe with the same tag and configuration.  ENOMEM if buffer space
  * or the histogram can not be allocated.  EIO if there was an error during
  * the read.  EINVAL in any input values are incorrect.
  */
@@ -151,6 +489,275 @@ int hdr_log_read(
     struct hdr_log_reader* reader, FILE* file, struct hdr_histogram** histogram,
     hdr_timespec* timestamp, hdr_timespec* interval);
 
+/**
+ * Reads the next entry with the given tag, as hdr_log_read.  Entries with
+ * other tags are skipped without decoding their histograms.  Delta encoded
+ * logs keep a separate chain per tag, so skipping entries of other tags
+ * does not break the deltas of the wanted one.
+ *
+ * @param reader 'This' pointer
+ * @param file The stream to read the histogram from.
+ * @param tag_filter The tag of the entries to read, NULL to read every entry.
+ * @param histogram Pointer to allocate a histogram to or merge into.
+ * @param timestamp The first timestamp from the CSV entry.
+ * @param interval The second timestamp from the CSV entry
+ * @param tag Output parameter to capture the tag of the entry, NULL if it has
+ * none, owned by the reader and valid until the next read.  May be NULL.
+ * @return As hdr_log_read, EOF (-1) once no entry with the tag is left.
+ */
+int hdr_log_read_tagged(
+    struct hdr_log_reader* reader, FILE* file, const char* tag_filter, struct hdr_histogram** histogram,
+    hdr_timespec* timestamp, hdr_timespec* interval, const char** tag);
+
+/**
+ * Reads the next entry with the given tag into the supplied histogram,
+ * replacing its counts rather than merging into them.  From its first call the
+ * reader keeps its line and decompression buffers and its decoder between
+ * reads, so that a log is read without allocating once the buffers have grown
+ * to fit its largest entry.  They are freed by hdr_log_reader_close, which
+ * must then be called.
+ *
+ * @param reader 'This' pointer
+ * @param file The stream to read the histogram from.
+ * @param tag_filter The tag of the entries to read, NULL to read every entry.
+ * @param histogram The histogram to reset and decode into.  Values outside of
+ * its range are handled as by hdr_add.
+ * @param timestamp The first timestamp from the CSV entry.
+ * @param interval The second timestamp from the CSV entry
+ * @param tag Output parameter to capture the tag of the entry, as for
+ * hdr_log_read_tagged.  May be NULL.
+ * @return As hdr_log_read_tagged.
+ */
+int hdr_log_read_into(
+    struct hdr_log_reader* reader, FILE* file, const char* tag_filter, struct hdr_histogram* histogram,
+    hdr_timespec* timestamp, hdr_timespec* interval, const char** tag);
+
+/**
+ * An interval log entry as it appears in a memory mapped log.
+ */
+struct hdr_log_entry
+{
+    hdr_timespec timestamp;
+    hdr_timespec interval;
+    /** The maximum value as written in the entry. */
+    double max_value;
+    /** The tag of the entry, pointing into the mapped log, NULL if it has none. */
+    const char* tag;
+    size_t tag_len;
+    /** The base64 encoded histogram, pointing into the mapped log. */
+    const char* base64;
+    size_t base64_len;
+};
+
+/**
+ * Conditions on the clear text fields of an interval line.  Readers check
+ * them before decoding the histogram of the line, so that looking for the few
+ * intervals whose max exceeded a threshold skips the base64 decoding and
+ * inflating of every other entry.
+ */
+struct hdr_log_filter
+{
+    /** Only entries with this tag, NULL for entries of any tag. */
+    const char* tag;
+    /** Only entries whose max value, as written in the line, is at least this. */
+    double min_interval_max;
+    /** Only entries whose start timestamp is at or after this, in seconds. */
+    double start_time;
+    /** Only entries whose start timestamp is before this, in seconds. */
+    double end_time;
+};
+
+/**
+ * Initialise a filter that matches every entry.
+ *
+ * @param filter 'This' pointer
+ */
+void hdr_log_filter_init(struct hdr_log_filter* filter);
+
+/**
+ * Check an entry against the filter.
+ *
+ * @param filter The filter, NULL matches every entry.
+ * @param entry The parsed entry.
+ * @return true if the entry meets every condition of the filter.
+ */
+bool hdr_log_filter_matches(const struct hdr_log_filter* filter, const struct hdr_log_entry* entry);
+
+/**
+ * Reads the next entry that matches the filter, as hdr_log_read_tagged.  The
+ * histograms of the entries it skips are not decoded, except in delta encoded
+ * logs, where skipped entries of a matching tag are still applied to the
+ * counts that the following entries of that tag build on.  Skipping an entry
+ * of any other tag drops the counts of that tag, so that reading it with a
+ * different filter returns HDR_LOG_DELTA_WITHOUT_KEYFRAME until its next
+ * keyframe.
+ *
+ * @param reader 'This' pointer
+ * @param file The stream to read the histogram from.
+ * @param filter The conditions on the entries to read, NULL to read every entry.
+ * @param histogram Pointer to allocate a histogram to or merge into.
+ * @param timestamp The first timestamp from the CSV entry.
+ * @param interval The second timestamp from the CSV entry
+ * @param tag Output parameter to capture the tag of the entry, as for
+ * hdr_log_read_tagged.  May be NULL.
+ * @return As hdr_log_read_tagged.
+ */
+int hdr_log_read_filtered(
+    struct hdr_log_reader* reader, FILE* file, const struct hdr_log_filter* filter,
+    struct hdr_histogram** histogram, hdr_timespec* timestamp, hdr_timespec* interval, const char** tag);
+
+struct hdr_log_mmap_reader
+{
+    /** The header of the log, as read by hdr_log_read_header. */
+    struct hdr_log_reader reader;
+    const char* data;
+    size_t length;
+    size_t position;
+    uint8_t* compressed;
+    size_t compressed_capacity;
+};
+
+/**
+ * Map the log file at 'path' into memory and read its header.  Entries are
+ * then parsed in place, without copying lines out of the page cache, which
+ * suits analysis jobs that read the same logs repeatedly.
+ *
+ * @param reader 'This' pointer
+ * @param path The log file to map.
+ * @return 0 on success, HDR_LOG_INVALID_VERSION if the header is missing or
+ * not supported, ENOMEM if the file could not be mapped, otherwise the errno
+ * of the failed system call.
+ */
+int hdr_log_mmap_reader_open(struct hdr_log_mmap_reader* reader, const char* path);
+
+/**
+ * Unmap the log and free the buffers held by the reader.
+ *
+ * @param reader 'This' pointer
+ */
+void hdr_log_mmap_reader_close(struct hdr_log_mmap_reader* reader);
+
+/**
+ * Parse the next entry of the log without decoding its histogram.  The base64
+ * span of the entry stays valid until the reader is closed.
+ *
+ * @param reader 'This' pointer
+ * @param entry Output parameter to capture the entry.
+ * @return 0 on success, EOF (-1) at the end of the log, EINVAL if the line is
+ * not an interval entry.  The reader moves past invalid lines.
+ */
+int hdr_log_mmap_next(struct hdr_log_mmap_reader* reader, struct hdr_log_entry* entry);
+
+/**
+ * Parse the next entry of the log that matches the filter, as
+ * hdr_log_mmap_next.  Skipped entries are handled as by hdr_log_read_filtered.
+ *
+ * @param reader 'This' pointer
+ * @param filter The conditions on the entries to return, NULL to return every
+ * entry.
+ * @param entry Output parameter to capture the entry.
+ * @return As hdr_log_mmap_next, or an error of hdr_log_mmap_decode met while
+ * applying a skipped delta encoded entry.
+ */
+int hdr_log_mmap_next_filtered(
+    struct hdr_log_mmap_reader* reader, const struct hdr_log_filter* filter, struct hdr_log_entry* entry);
+
+/**
+ * Decode the histogram of an entry, as hdr_log_read does.  The reader keeps a
+ * single decoder and decompression buffer for all of its entries.  Entries of
+ * delta encoded logs must be decoded in the order they were read.
+ *
+ * @param reader 'This' pointer
+ * @param entry The entry returned by hdr_log_mmap_next.
+ * @param histogram Pointer to allocate a histogram to or merge into.
+ * @return As hdr_log_read.
+ */
+int hdr_log_mmap_decode(
+    struct hdr_log_mmap_reader* reader, const struct hdr_log_entry* entry, struct hdr_histogram** histogram);
+
+/**
+ * Read and decode the next entry of the log, as hdr_log_read.
+ *
+ * @param reader 'This' pointer
+ * @param histogram Pointer to allocate a histogram to or merge into.
+ * @param timestamp The first timestamp from the CSV entry.
+ * @param interval The second timestamp from the CSV entry
+ * @return As hdr_log_read.
+ */
+int hdr_log_mmap_read(
+    struct hdr_log_mmap_reader* reader, struct hdr_histogram** histogram,
+    hdr_timespec* timestamp, hdr_timespec* interval);
+
+/**
+ * Callback of hdr_log_mmap_process, choosing the histogram an entry is decoded
+ * into from the accumulator of the thread that read it.
+ *
+ * @param accumulator The accumulator of the calling thread.
+ * @param entry The entry about to be decoded.
+ * @return The histogram to merge the entry into, where a pointer to NULL has a
+ * histogram allocated into it, or NULL to skip the entry.
+ */
+typedef struct hdr_histogram** (*hdr_log_target_fn)(void* accumulator, const struct hdr_log_entry* entry);
+
+/**
+ * Decode the remaining entries of the log on several threads.  The mapped log
+ * is split at line boundaries into one range per thread, and each thread
+ * decodes the entries of its range, in log order, into the histograms 'target'
+ * picks from that thread's accumulator.  The caller merges the accumulators
+ * once this returns, e.g. per thread totals or per time bucket histograms.
+ *
+ * Blank lines are skipped.  Delta encoded logs are decoded on the calling
+ * thread alone, using only the first accumulator, and carry on from the
+ * entries already read from the reader.  Their entries are decoded even when
+ * 'target' skips them, as the entries that follow build on them.
+ *
+ * @param reader 'This' pointer
+ * @param threads The number of threads to decode with, including the calling thread.
+ * @param target Picks the histogram each entry is decoded into.
+ * @param accumulators One accumulator per thread, passed to 'target'.
+ * @return 0 on success, EINVAL if threads is less than 1, EAGAIN if a thread
+ * could not be started, otherwise the first error of hdr_log_mmap_read met by
+ * any of the threads.
+ */
+int hdr_log_mmap_process(
+    struct hdr_log_mmap_reader* reader, int32_t threads, hdr_log_target_fn target, void** accumulators);
+
+/**
+ * Merge the remaining entries of the log into a single histogram, decoding
+ * them on several threads as hdr_log_mmap_process.
+ *
+ * @param reader 'This' pointer
+ * @param threads The number of threads to decode with, including the calling thread.
+ * @param histogram Pointer to allocate a histogram to or merge into, left
+ * NULL if the log has no entries.
+ * @return As hdr_log_mmap_process, or ENOMEM if the per thread histograms
+ * could not be allocated.
+ */
+int hdr_log_mmap_merge(struct hdr_log_mmap_reader* reader, int32_t threads, struct hdr_histogram** histogram);
+
+/**
+ * Write a coarser copy of an interval log, merging the entries of each tag
+ * either every 'intervals' entries or per window of 'period', windows being
+ * aligned to multiples of the period from a start timestamp of 0.  Entries
+ * are decoded straight into one histogram per tag, so memory does not grow
+ * with the length of the log.
+ *
+ * Each merged entry starts at the start timestamp of its first entry and ends
+ * at the latest end timestamp of the entries it merges.  The output is not
+ * delta encoded and entries are written as their intervals complete.  When
+ * merging by period, an entry completes the windows of every tag that ended
+ * before it, which are written earliest first.
+ *
+ * @param input The log to read, positioned at its header.
+ * @param output The stream to write the coarser log to.
+ * @param intervals The number of entries to merge, 0 when merging by period.
+ * @param period The length of the windows to merge, NULL when merging by count.
+ * @return 0 on success, EINVAL if neither or both of intervals and period are
+ * given or the period is not positive, otherwise as hdr_log_read and
+ * hdr_log_write.
+ */
+int hdr_log_rollup(FILE* input, FILE* output, int32_t intervals, const hdr_timespec* period);
+
 /**
  * Returns a string representation of the error number.
  *
@@ -0,0 +1,455 @@
+/**
+ * hdr_histogram_shm.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <windows.h>
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#endif
+
+#include "hdr_atomic.h"
+#include "hdr_histogram.h"
+#include "hdr_histogram_shm.h"
+#include "hdr_tests.h"
+
+#define HDR_SHM_COOKIE 0x1c8493a0
+#define HDR_SHM_VERSION 1
+/* Keeps the counts array cache line aligned within the mapping. */
+#define HDR_SHM_HEADER_LEN 128
+
+struct hdr_histogram_shm_header
+{
+    int32_t cookie;
+    int32_t version;
+    int32_t header_len;
+    int32_t reserved;
+    struct hdr_histogram_bucket_config cfg;
+    int64_t total_count;
+    int64_t min_value;
+    int64_t max_value;
+};
+
+/* ########  ##          ###    ######## ########  #######  ########  ##     ## */
+/* ##     ## ##         ## ##      ##    ##       ##     ## ##     ## ###   ### */
+/* ##     ## ##        ##   ##     ##    ##       ##     ## ##     ## #### #### */
+/* ########  ##       ##     ##    ##    ######   ##     ## ########  ## ### ## */
+/* ##        ##       #########    ##    ##       ##     ## ##   ##   ##     ## */
+/* ##        ##       ##     ##    ##    ##       ##     ## ##    ##  ##     ## */
+/* ##        ######## ##     ##    ##    ##        #######  ##     ## ##     ## */
+
+#if defined(_WIN32) || defined(_WIN64)
+
+typedef HANDLE shm_file;
+#define SHM_INVALID_FILE INVALID_HANDLE_VALUE
+
+static int shm_file_open_locked(const char* path, bool create, shm_file* file)
+{
+    OVERLAPPED overlapped;
+    HANDLE handle = CreateFileA(
+        path, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (INVALID_HANDLE_VALUE == handle)
+    {
+        return ERROR_FILE_NOT_FOUND == GetLastError() ? ENOENT : EIO;
+    }
+
+    /* Lock a byte well past the end of the file so the lock never overlaps the mapped data. */
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = 0xFFFFFFFE;
+    overlapped.OffsetHigh = 0x7FFFFFFF;
+    if (!LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped))
+    {
+        CloseHandle(handle);
+        return EIO;
+    }
+
+    *file = handle;
+    return 0;
+}
+
+static void shm_file_unlock_close(shm_file file)
+{
+    OVERLAPPED overlapped;
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = 0xFFFFFFFE;
+    overlapped.OffsetHigh = 0x7FFFFFFF;
+    UnlockFileEx(file, 0, 1, 0, &overlapped);
+    CloseHandle(file);
+}
+
+static int shm_file_size(shm_file file, int64_t* size)
+{
+    LARGE_INTEGER file_size;
+
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        return EIO;
+    }
+
+    *size = file_size.QuadPart;
+    return 0;
+}
+
+static int shm_file_map(shm_file file, size_t len, void** mapping)
+{
+    /* Creating a mapping larger than the file extends it with zeros. */
+    HANDLE map_handle = CreateFileMappingA(
+        file, NULL, PAGE_READWRITE, (DWORD) ((uint64_t) len >> 32), (DWORD) len, NULL);
+    void* view;
+
+    if (NULL == map_handle)
+    {
+        return ENOMEM;
+    }
+
+    view = MapViewOfFile(map_handle, FILE_MAP_ALL_ACCESS, 0, 0, len);
+    CloseHandle(map_handle);
+
+    if (NULL == view)
+    {
+        return ENOMEM;
+    }
+
+    *mapping = view;
+    return 0;
+}
+
+static void shm_file_unmap(void* mapping, size_t len)
+{
+    (void)len;
+    UnmapViewOfFile(mapping);
+}
+
+#else
+
+typedef int shm_file;
+#define SHM_INVALID_FILE (-1)
+
+static int shm_file_open_locked(const char* path, bool create, shm_file* file)
+{
+    int fd = open(path, create ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    if (flock(fd, LOCK_EX) != 0)
+    {
+        int rc = errno;
+        close(fd);
+        return rc;
+    }
+
+    *file = fd;
+    return 0;
+}
+
+static void shm_file_unlock_close(shm_file file)
+{
+    flock(file, LOCK_UN);
+    close(file);
+}
+
+static int shm_file_size(shm_file file, int64_t* size)
+{
+    struct stat st;
+
+    if (fstat(file, &st) != 0)
+    {
+        return errno;
+    }
+
+    *size = (int64_t) st.st_size;
+    return 0;
+}
+
+static int shm_file_map(shm_file file, size_t len, void** mapping)
+{
+    struct stat st;
+    void* addr;
+
+    if (fstat(file, &st) != 0)
+    {
+        return errno;
+    }
+
+    if ((size_t) st.st_size < len && ftruncate(file, (off_t) len) != 0)
+    {
+        return errno;
+    }
+
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (MAP_FAILED == addr)
+    {
+        return errno;
+    }
+
+    *mapping = addr;
+    return 0;
+}
+
+static void shm_file_unmap(void* mapping, size_t len)
+{
+    munmap(mapping, len);
+}
+
+#endif
+
+/*  ######  ##     ##    ###    ########  ######## ########   */
+/* ##    ## ##     ##   ## ##   ##     ## ##       ##     ##  */
+/* ##       ##     ##  ##   ##  ##     ## ##       ##     ##  */
+/*  ######  ######### ##     ## ########  ######   ##     ##  */
+/*       ## ##     ## ######### ##   ##   ##       ##     ##  */
+/* ##    ## ##     ## ##     ## ##    ##  ##       ##     ##  */
+/*  ######  ##     ## ##     ## ##     ## ######## ########   */
+
+static size_t shm_mapped_len(const struct hdr_histogram_bucket_config* cfg)
+{
+    return HDR_SHM_HEADER_LEN + (size_t) cfg->counts_len * sizeof(int64_t);
+}
+
+static bool shm_configs_match(
+    const struct hdr_histogram_bucket_config* a, const struct hdr_histogram_bucket_config* b)
+{
+    return a->lowest_trackable_value == b->lowest_trackable_value &&
+        a->highest_trackable_value == b->highest_trackable_value &&
+        a->significant_figures == b->significant_figures &&
+        a->counts_len == b->counts_len;
+}
+
+static int shm_validate_header(const struct hdr_histogram_shm_header* header, int64_t file_size)
+{
+    struct hdr_histogram_bucket_config expected;
+
+    if (HDR_SHM_COOKIE != header->cookie ||
+        HDR_SHM_VERSION != header->version ||
+        HDR_SHM_HEADER_LEN != header->header_len)
+    {
+        return EINVAL;
+    }
+
+    /* Recompute the layout rather than trusting the derived fields in the file. */
+    if (hdr_calculate_bucket_config(
+            header->cfg.lowest_trackable_value,
+            header->cfg.highest_trackable_value,
+            (int) header->cfg.significant_figures,
+            &expected) != 0 ||
+        !shm_configs_match(&expected, &header->cfg))
+    {
+        return EINVAL;
+    }
+
+    if (file_size < (int64_t) shm_mapped_len(&expected))
+    {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+int hdr_histogram_shm_open(
+    const char* path,
+    const struct hdr_histogram_bucket_config* cfg,
+    struct hdr_histogram_shm** result)
+{
+    struct hdr_histogram_shm* shm = NULL;
+    struct hdr_histogram_shm_header* header;
+    struct hdr_histogram_bucket_config local_cfg;
+    void* mapping = NULL;
+    size_t mapped_len = 0;
+    int64_t file_size = 0;
+    shm_file file = SHM_INVALID_FILE;
+    int rc;
+
+    rc = shm_file_open_locked(path, NULL != cfg, &file);
+    if (rc)
+    {
+        return rc;
+    }
+
+    rc = shm_file_size(file, &file_size);
+    if (rc)
+    {
+        goto cleanup;
+    }
+
+    if (0 == file_size)
+    {
+        if (NULL == cfg)
+        {
+            rc = ENOENT;
+            goto cleanup;
+        }
+
+        mapped_len = shm_mapped_len(cfg);
+        rc = shm_file_map(file, mapped_len, &mapping);
+        if (rc)
+        {
+            goto cleanup;
+        }
+
+        header = (struct hdr_histogram_shm_header*) mapping;
+        header->version = HDR_SHM_VERSION;
+        header->header_len = HDR_SHM_HEADER_LEN;
+        header->cfg = *cfg;
+        header->total_count = 0;
+        header->min_value = INT64_MAX;
+        header->max_value = 0;
+        /* Publish the cookie last, the file lock orders it for other openers. */
+        header->cookie = HDR_SHM_COOKIE;
+    }
+    else
+    {
+        if (file_size < HDR_SHM_HEADER_LEN)
+        {
+            rc = EINVAL;
+            goto cleanup;
+        }
+
+        mapped_len = (size_t) file_size;
+        rc = shm_file_map(file, mapped_len, &mapping);
+        if (rc)
+        {
+            goto cleanup;
+        }
+
+        header = (struct hdr_histogram_shm_header*) mapping;
+        rc = shm_validate_header(header, file_size);
+        if (rc)
+        {
+            goto cleanup;
+        }
+
+        if (NULL != cfg && !shm_configs_match(cfg, &header->cfg))
+        {
+            rc = EINVAL;
+            goto cleanup;
+        }
+    }
+
+    if ((shm = calloc(1, sizeof(struct hdr_histogram_shm))) == NULL)
+    {
+        rc = ENOMEM;
+        goto cleanup;
+    }
+
+    local_cfg = header->cfg;
+    hdr_init_preallocated(&shm->histogram, &local_cfg);
+    shm->histogram.counts = (int64_t*) ((uint8_t*) mapping + HDR_SHM_HEADER_LEN);
+    shm->header = header;
+    shm->mapped_len = mapped_len;
+    hdr_histogram_shm_sync(shm);
+
+    *result = shm;
+
+cleanup:
+    if (rc && NULL != mapping)
+    {
+        shm_file_unmap(mapping, mapped_len);
+    }
+    shm_file_unlock_close(file);
+
+    return rc;
+}
+
+void hdr_histogram_shm_close(struct hdr_histogram_shm* shm)
+{
+    shm_file_unmap(shm->header, shm->mapped_len);
+    free(shm);
+}
+
+bool hdr_histogram_shm_record_value(struct hdr_histogram_shm* shm, int64_t value)
+{
+    return hdr_histogram_shm_record_values(shm, value, 1);
+}
+
+bool hdr_histogram_shm_record_values(struct hdr_histogram_shm* shm, int64_t value, int64_t count)
+{
+    struct hdr_histogram_shm_header* header = shm->header;
+    int64_t current_min_value;
+    int64_t current_max_value;
+    int32_t counts_index;
+
+    if (value < 0)
+    {
+        return false;
+    }
+
+    counts_index = counts_index_for(&shm->histogram, value);
+
+    if (counts_index < 0 || shm->histogram.counts_len <= counts_index)
+    {
+        return false;
+    }
+
+    hdr_atomic_add_fetch_64(&shm->histogram.counts[counts_index], count);
+    hdr_atomic_add_fetch_64(&header->total_count, count);
+
+    do
+    {
+        current_min_value = hdr_atomic_load_64(&header->min_value);
+
+        if (0 == value || current_min_value <= value)
+        {
+            break;
+        }
+    }
+    while (!hdr_atomic_compare_exchange_64(&header->min_value, &current_min_value, value));
+
+    do
+    {
+        current_max_value = hdr_atomic_load_64(&header->max_value);
+
+        if (value <= current_max_value)
+        {
+            break;
+        }
+    }
+    while (!hdr_atomic_compare_exchange_64(&header->max_value, &current_max_value, value));
+
+    return true;
+}
+
+struct hdr_histogram* hdr_histogram_shm_sync(struct hdr_histogram_shm* shm)
+{
+    shm->histogram.total_count = hdr_atomic_load_64(&shm->header->total_count);
+    shm->histogram.min_value = hdr_atomic_load_64(&shm->header->min_value);
+    shm->histogram.max_value = hdr_atomic_load_64(&shm->header->max_value);
+
+    return &shm->histogram;
+}
+
+void hdr_histogram_shm_reset(struct hdr_histogram_shm* shm)
+{
+    memset(shm->histogram.counts, 0, sizeof(int64_t) * shm->histogram.counts_len);
+    hdr_atomic_store_64(&shm->header->total_count, 0);
+    hdr_atomic_store_64(&shm->header->min_value, INT64_MAX);
+    hdr_atomic_store_64(&shm->header->max_value, 0);
+
+    hdr_histogram_shm_sync(shm);
+}
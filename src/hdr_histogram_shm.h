@@ -0,0 +1,111 @@
+/**
+ * hdr_histogram_shm.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A histogram whose counts live in a memory mapped file, so that several
+ * processes can record into, and read from, the same histogram without
+ * encoding and merging it.  The file starts with a versioned header carrying
+ * the hdr_histogram_bucket_config the counts were laid out with, followed by
+ * the counts array.  The file is in native byte order and is only meant to be
+ * shared between processes on the same host.
+ */
+
+#ifndef HDR_HISTOGRAM_SHM_H
+#define HDR_HISTOGRAM_SHM_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hdr_histogram.h"
+
+struct hdr_histogram_shm_header;
+
+struct hdr_histogram_shm
+{
+    /** Process local view of the shared histogram, counts point into the mapping. */
+    struct hdr_histogram histogram;
+    struct hdr_histogram_shm_header* header;
+    size_t mapped_len;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Map the histogram stored in the file at 'path', creating and initialising
+ * the file if it does not exist yet.
+ *
+ * If the file already holds a histogram its header must match the supplied
+ * configuration.  Passing a NULL cfg opens an existing file with whatever
+ * configuration it was created with, which is how a reading process attaches
+ * to histograms created by the recording processes.
+ *
+ * @param path The file backing the shared histogram.
+ * @param cfg The bucket configuration, as computed by hdr_calculate_bucket_config,
+ * or NULL to adopt the configuration stored in an existing file.
+ * @param result Output parameter to capture the mapped histogram.
+ * @return 0 on success, EINVAL if the file header is invalid or does not match
+ * cfg, ENOENT if cfg is NULL and the file does not hold a histogram, ENOMEM if
+ * malloc failed, otherwise the errno of the failed system call.
+ */
+int hdr_histogram_shm_open(
+    const char* path,
+    const struct hdr_histogram_bucket_config* cfg,
+    struct hdr_histogram_shm** result);
+
+/**
+ * Unmap the shared histogram and free the local view.  The backing file is
+ * left in place.
+ *
+ * @param shm The shared histogram to close.
+ */
+void hdr_histogram_shm_close(struct hdr_histogram_shm* shm);
+
+/**
+ * Records a value in the shared histogram.  Safe to call concurrently from
+ * any number of threads and processes mapping the same file.
+ *
+ * @param shm "This" pointer
+ * @param value Value to add to the histogram
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_histogram_shm_record_value(struct hdr_histogram_shm* shm, int64_t value);
+
+/**
+ * Records count values in the shared histogram.  Safe to call concurrently
+ * from any number of threads and processes mapping the same file.
+ *
+ * @param shm "This" pointer
+ * @param value Value to add to the histogram
+ * @param count Number of 'value's to add to the histogram
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_histogram_shm_record_values(struct hdr_histogram_shm* shm, int64_t value, int64_t count);
+
+/**
+ * Refresh the total count, min and max of the local view from the shared
+ * header and return it.  The returned histogram can be passed to any of the
+ * read only hdr_histogram functions, values recorded concurrently may or may
+ * not be reflected in the result.
+ *
+ * @param shm "This" pointer
+ * @return The local view of the shared histogram.
+ */
+struct hdr_histogram* hdr_histogram_shm_sync(struct hdr_histogram_shm* shm);
+
+/**
+ * Reset the shared histogram to zero for every process mapping it.
+ *
+ * @param shm "This" pointer
+ */
+void hdr_histogram_shm_reset(struct hdr_histogram_shm* shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -47,6 +47,53 @@ void hdr_mutex_unlock(struct hdr_mutex* mutex)
     LeaveCriticalSection((CRITICAL_SECTION*)(mutex->_critical_section));
 }
 
+int hdr_cond_init(struct hdr_cond* cond)
+{
+    InitializeConditionVariable((CONDITION_VARIABLE*)(&cond->_condition_variable));
+    return 0;
+}
+
+void hdr_cond_destroy(struct hdr_cond* cond)
+{
+    (void) cond;
+}
+
+void hdr_cond_wait(struct hdr_cond* cond, struct hdr_mutex* mutex)
+{
+    SleepConditionVariableCS(
+        (CONDITION_VARIABLE*)(&cond->_condition_variable),
+        (CRITICAL_SECTION*)(mutex->_critical_section),
+        INFINITE);
+}
+
+void hdr_cond_broadcast(struct hdr_cond* cond)
+{
+    WakeAllConditionVariable((CONDITION_VARIABLE*)(&cond->_condition_variable));
+}
+
+static DWORD WINAPI hdr_thread_start(LPVOID thread)
+{
+    ((struct hdr_thread*) thread)->_function(((struct hdr_thread*) thread)->_arg);
+    return 0;
+}
+
+int hdr_thread_create(struct hdr_thread* thread, void (*function)(void*), void* arg)
+{
+    thread->_function = function;
+    thread->_arg = arg;
+    thread->_handle = CreateThread(NULL, 0, hdr_thread_start, thread, 0, NULL);
+
+    return NULL == thread->_handle ? -1 : 0;
+}
+
+int hdr_thread_join(struct hdr_thread* thread)
+{
+    DWORD rc = WaitForSingleObject(thread->_handle, INFINITE);
+    CloseHandle(thread->_handle);
+
+    return WAIT_OBJECT_0 == rc ? 0 : -1;
+}
+
 void hdr_yield()
 {
     Sleep(0);
@@ -88,6 +135,45 @@ void hdr_mutex_unlock(struct hdr_mutex* mutex)
     pthread_mutex_unlock(&mutex->_mutex);
 }
 
+int hdr_cond_init(struct hdr_cond* cond)
+{
+    return pthread_cond_init(&cond->_cond, NULL);
+}
+
+void hdr_cond_destroy(struct hdr_cond* cond)
+{
+    pthread_cond_destroy(&cond->_cond);
+}
+
+void hdr_cond_wait(struct hdr_cond* cond, struct hdr_mutex* mutex)
+{
+    pthread_cond_wait(&cond->_cond, &mutex->_mutex);
+}
+
+void hdr_cond_broadcast(struct hdr_cond* cond)
+{
+    pthread_cond_broadcast(&cond->_cond);
+}
+
+static void* hdr_thread_start(void* thread)
+{
+    ((struct hdr_thread*) thread)->_function(((struct hdr_thread*) thread)->_arg);
+    return NULL;
+}
+
+int hdr_thread_create(struct hdr_thread* thread, void (*function)(void*), void* arg)
+{
+    thread->_function = function;
+    thread->_arg = arg;
+
+    return pthread_create(&thread->_thread, NULL, hdr_thread_start, thread);
+}
+
+int hdr_thread_join(struct hdr_thread* thread)
+{
+    return pthread_join(thread->_thread, NULL);
+}
+
 void hdr_yield()
 {
     sched_yield();
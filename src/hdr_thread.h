@@ -20,6 +20,18 @@ typedef struct hdr_mutex
     uint8_t _critical_section[40];
 } hdr_mutex;
 
+typedef struct hdr_cond
+{
+    void* _condition_variable;
+} hdr_cond;
+
+typedef struct hdr_thread
+{
+    void* _handle;
+    void (*_function)(void*);
+    void* _arg;
+} hdr_thread;
+
 #else
 
 #include <pthread.h>
@@ -31,6 +43,18 @@ typedef struct hdr_mutex
 {
     pthread_mutex_t _mutex;
 } hdr_mutex;
+
+typedef struct hdr_cond
+{
+    pthread_cond_t _cond;
+} hdr_cond;
+
+typedef struct hdr_thread
+{
+    pthread_t _thread;
+    void (*_function)(void*);
+    void* _arg;
+} hdr_thread;
 #endif
 
 #ifdef __cplusplus
@@ -46,6 +70,15 @@ void hdr_mutex_destroy(struct hdr_mutex* mutex);
 void hdr_mutex_lock(struct hdr_mutex* mutex);
 void hdr_mutex_unlock(struct hdr_mutex* mutex);
 
+int hdr_cond_init(struct hdr_cond* cond);
+void hdr_cond_destroy(struct hdr_cond* cond);
+
+void hdr_cond_wait(struct hdr_cond* cond, struct hdr_mutex* mutex);
+void hdr_cond_broadcast(struct hdr_cond* cond);
+
+int hdr_thread_create(struct hdr_thread* thread, void (*function)(void*), void* arg);
+int hdr_thread_join(struct hdr_thread* thread);
+
 void hdr_yield(void);
 int hdr_usleep(unsigned int useconds);
 
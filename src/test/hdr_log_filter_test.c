@@ -0,0 +1,89 @@
+/**
+ * hdr_log_filter_test.c
+ * Written by the HdrHistogram contributors and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdr_histogram.h"
+#include "hdr_histogram_log.h"
+
+#define CHECK(cond, message)                                   \
+    do {                                                       \
+        if (!(cond))                                           \
+        {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, message); \
+            return 1;                                          \
+        }                                                      \
+    } while (0)
+
+/* Entries of tags a and b alternate in a delta encoded log.  Reading only a */
+/* skips the deltas of b, so reading b again must fail until its next        */
+/* keyframe instead of adding the next delta to stale counts.                */
+static int test_switch_tag_filter(void)
+{
+    const char* filters[] = { NULL, NULL, "a", "a", NULL };
+    struct hdr_log_writer writer;
+    struct hdr_log_reader reader;
+    struct hdr_histogram* h;
+    struct hdr_histogram* read;
+    hdr_timespec timestamp = { 0, 0 };
+    const char* tag;
+    FILE* f;
+    int i, rc;
+
+    CHECK((f = tmpfile()) != NULL, "tmpfile");
+    CHECK(hdr_init(1, 100000, 3, &h) == 0, "hdr_init");
+    CHECK(hdr_log_writer_init(&writer) == 0, "hdr_log_writer_init");
+    CHECK(hdr_log_writer_enable_deltas(&writer, 8) == 0, "hdr_log_writer_enable_deltas");
+    CHECK(hdr_log_write_header(&writer, f, NULL, &timestamp) == 0, "hdr_log_write_header");
+
+    for (i = 0; i < 12; i++)
+    {
+        timestamp.tv_sec = i;
+        hdr_reset(h);
+        hdr_record_values(h, 10 + i, i / 2 + 1);
+        rc = hdr_log_write_tagged(&writer, f, i % 2 ? "b" : "a", &timestamp, &timestamp, h);
+        CHECK(rc == 0, "hdr_log_write_tagged");
+    }
+
+    hdr_log_writer_close(&writer);
+    hdr_close(h);
+    rewind(f);
+
+    CHECK(hdr_log_reader_init(&reader) == 0, "hdr_log_reader_init");
+    CHECK(hdr_log_read_header(&reader, f) == 0, "hdr_log_read_header");
+
+    for (i = 0; i < 4; i++)
+    {
+        read = NULL;
+        rc = hdr_log_read_tagged(&reader, f, filters[i], &read, &timestamp, NULL, &tag);
+        CHECK(rc == 0, "hdr_log_read_tagged");
+        CHECK(read->total_count == timestamp.tv_sec / 2 + 1, "total count of a read entry");
+        hdr_close(read);
+    }
+
+    read = NULL;
+    rc = hdr_log_read_tagged(&reader, f, filters[4], &read, &timestamp, NULL, &tag);
+    CHECK(rc == HDR_LOG_DELTA_WITHOUT_KEYFRAME, "delta of a tag whose previous entries were skipped");
+    CHECK(read == NULL, "no histogram for a delta without keyframe");
+
+    hdr_log_reader_close(&reader);
+    fclose(f);
+
+    return 0;
+}
+
+int main(void)
+{
+    if (test_switch_tag_filter())
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("hdr_log_filter_test: OK\n");
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,10 @@
 'use strict'
 
 const test = require('tap').test
+const fs = require('fs')
+const os = require('os')
+const path = require('path')
+const { Readable } = require('stream')
 const Histogram = require('./')
 
 test('create an histogram', (t) => {
@@ -84,6 +88,27 @@ test('encode/decode', (t) => {
   t.end()
 })
 
+test('encodeInto', (t) => {
+  const instance = Histogram(1, 100)
+  instance.record(42)
+  instance.record(45)
+  const encoded = instance.encode()
+  t.ok(instance.encodeBound() >= encoded.length, 'bound is large enough')
+  const buf = Buffer.alloc(instance.encodeBound() + 10)
+  const written = instance.encodeInto(buf, 10)
+  t.equal(written, encoded.length, 'same length as encode()')
+  t.ok(buf.slice(10, 10 + written).equals(encoded), 'same bytes as encode()')
+  const instance2 = Histogram.decode(buf.slice(10, 10 + written))
+  t.equal(instance2.percentile(99), 45, 'percentile match')
+  const exact = Buffer.alloc(encoded.length + 1, 0xff)
+  t.equal(instance.encodeInto(exact.slice(0, encoded.length)), encoded.length, 'fits a buffer of encode() bytes')
+  t.equal(exact[encoded.length], 0xff, 'leaves the byte after the output alone')
+  t.throws(() => instance.encodeInto(Buffer.alloc(4)), 'buffer too small throws')
+  t.throws(() => instance.encodeInto(buf, buf.length + 1), 'offset out of range throws')
+  t.throws(() => instance.encodeInto('hello'), 'not a buffer throws')
+  t.end()
+})
+
 test('fail decode', (t) => {
   t.throws(() => Histogram.decode())
   t.throws(() => Histogram.decode('hello'))
@@ -161,3 +186,226 @@ test('reset histogram', (t) => {
   t.equal(instance, resetInstance)
   t.end()
 })
+
+test('shared histogram', (t) => {
+  const file = path.join(os.tmpdir(), `hdr-shared-${process.pid}.hist`)
+  const writer = Histogram.openShared(file, 1, 100)
+  const reader = Histogram.openShared(file)
+  t.ok(writer.record(42))
+  t.ok(writer.record(45))
+  t.equal(reader.min(), 42, 'min is shared')
+  t.equal(reader.max(), 45, 'max is shared')
+  t.equal(reader.percentile(99), 45, 'percentile is shared')
+  t.ok(reader.record(52))
+  t.equal(writer.max(), 52, 'both sides can record')
+  t.throws(() => Histogram.openShared(file, 1, 1000), 'config mismatch throws')
+  t.ok(reader.reset())
+  t.equal(writer.max(), 0, 'reset is shared')
+  try {
+    fs.unlinkSync(file)
+  } catch (err) {}
+  t.end()
+})
+
+test('shared histogram arguments checks', (t) => {
+  t.throws(() => Histogram.openShared())
+  t.throws(() => Histogram.openShared(path.join(os.tmpdir(), 'hdr-shared-missing.hist')))
+  t.throws(() => Histogram.openShared(path.join(os.tmpdir(), 'hdr-shared-bad.hist'), 1, 100, 6))
+  t.end()
+})
+
+test('subtract', (t) => {
+  const cumulative = Histogram(1, 100)
+  t.ok(cumulative.record(42))
+  t.ok(cumulative.record(45))
+  const snapshot = Histogram.decode(cumulative.encode())
+  t.ok(cumulative.record(50))
+  t.ok(cumulative.record(55))
+  t.equal(cumulative.subtract(snapshot), cumulative, 'returns itself')
+  t.equal(cumulative.min(), 50, 'min is recomputed')
+  t.equal(cumulative.max(), 55, 'max is recomputed')
+  t.equal(cumulative.mean(), 52.5, 'only the delta is left')
+  t.throws(() => cumulative.subtract(), 'missing histogram throws')
+  t.throws(() => cumulative.subtract({}), 'not a histogram throws')
+  t.end()
+})
+
+test('subtract with a different configuration', (t) => {
+  const cumulative = Histogram(1, 1000)
+  t.ok(cumulative.record(42))
+  t.ok(cumulative.record(420))
+  const earlier = Histogram(1, 100)
+  t.ok(earlier.record(42))
+  cumulative.subtract(earlier)
+  t.equal(cumulative.min(), 420, 'min is recomputed')
+  t.equal(cumulative.percentile(50), 420, 'only the delta is left')
+  t.end()
+})
+
+test('shift values', (t) => {
+  const instance = Histogram(1, 1000000)
+  t.ok(instance.record(5000))
+  t.ok(instance.record(45000))
+  t.equal(instance.shiftValuesLeft(3), instance, 'returns itself')
+  t.equal(instance.min(), 40000, 'min is shifted')
+  t.equal(instance.max(), 360191, 'max is shifted')
+  t.equal(instance.percentile(10), 40031, 'percentile is shifted')
+  t.equal(instance.shiftValuesRight(3), instance, 'returns itself')
+  t.equal(instance.min(), 5000, 'min is shifted back')
+  t.equal(instance.max(), 45023, 'max is shifted back')
+  t.equal(instance.percentile(10), 5003, 'percentile is shifted back')
+  t.throws(() => instance.shiftValuesLeft(), 'missing shift throws')
+  t.throws(() => instance.shiftValuesLeft(-1), 'negative shift throws')
+  t.throws(() => instance.shiftValuesLeft(20), 'overflow throws')
+  t.throws(() => instance.shiftValuesRight(8), 'underflow throws')
+  t.equal(instance.max(), 45023, 'failed shifts leave the histogram unchanged')
+  t.end()
+})
+
+test('percentileAtOrBelow', (t) => {
+  const instance = Histogram(1, 1000)
+  t.equal(instance.percentileAtOrBelow(250), 100, 'empty histogram is 100%')
+  t.ok(instance.record(42))
+  t.ok(instance.record(200))
+  t.ok(instance.record(300))
+  t.ok(instance.record(400))
+  t.equal(instance.percentileAtOrBelow(250), 50, 'half of the values are under 250')
+  t.equal(instance.percentileAtOrBelow(400), 100, 'all of the values are under 400')
+  t.equal(instance.percentileAtOrBelow(10), 0, 'none of the values are under 10')
+  t.throws(() => instance.percentileAtOrBelow(), 'missing value throws')
+  t.end()
+})
+
+test('countBetween', (t) => {
+  const instance = Histogram(1, 1000)
+  t.ok(instance.record(42))
+  t.ok(instance.record(200))
+  t.ok(instance.record(300))
+  t.ok(instance.record(400))
+  t.equal(instance.countBetween(100, 300), 2, 'counts the values in the range')
+  t.equal(instance.countBetween(0, 1000), 4, 'counts all of the values')
+  t.equal(instance.countBetween(500, 1000), 0, 'counts nothing past the max')
+  t.throws(() => instance.countBetween(100), 'missing bound throws')
+  t.end()
+})
+
+test('log writer and reader', (t) => {
+  const file = path.join(os.tmpdir(), `hdr-log-${process.pid}.hlog`)
+  const writer = new Histogram.LogWriter(file, { startTime: 1000 })
+  for (let i = 0; i < 3; i++) {
+    const instance = Histogram(1, 100)
+    instance.record(10 + i)
+    instance.record(42)
+    writer.write({ histogram: instance, startTimestamp: 1000 + i, endTimestamp: 1001 + i, tag: i === 1 ? 'b' : 'a' })
+  }
+  writer.end()
+  writer.on('finish', () => {
+    const entries = []
+    new Histogram.LogReader(file)
+      .on('data', (entry) => entries.push(entry))
+      .on('end', () => {
+        t.equal(entries.length, 3, 'reads every entry')
+        t.equal(entries[0].histogram.min(), 10, 'min match')
+        t.equal(entries[2].histogram.percentile(10), 12, 'percentile match')
+        t.equal(entries[2].histogram.max(), 42, 'max match')
+        t.equal(entries[1].startTimestamp, 1001, 'start timestamp match')
+        t.equal(entries[1].endTimestamp, 1002, 'end timestamp match')
+        t.deepEqual(entries.map((entry) => entry.tag), ['a', 'b', 'a'], 'tags match')
+        try {
+          fs.unlinkSync(file)
+        } catch (err) {}
+        t.end()
+      })
+  })
+})
+
+test('log reader tag filter', (t) => {
+  const file = path.join(os.tmpdir(), `hdr-log-tag-${process.pid}.hlog`)
+  const writer = new Histogram.LogWriter(file, { keyframeInterval: 2 })
+  for (let i = 0; i < 10; i++) {
+    const instance = Histogram(1, 100)
+    instance.record(i + 1)
+    writer.write({ histogram: instance, startTimestamp: i, endTimestamp: i + 1, tag: i % 2 ? 'odd' : 'even' })
+  }
+  writer.end(() => {
+    const reader = new Histogram.LogReader(file, { tag: 'odd', chunkSize: 2 })
+    const mins = []
+    reader.on('data', (entry) => mins.push(entry.histogram.min()))
+    reader.on('end', () => {
+      t.deepEqual(mins, [2, 4, 6, 8, 10], 'reads the delta encoded entries of the tag')
+      try {
+        fs.unlinkSync(file)
+      } catch (err) {}
+      t.end()
+    })
+  })
+})
+
+test('log reader filters', (t) => {
+  const file = path.join(os.tmpdir(), `hdr-log-filter-${process.pid}.hlog`)
+  const writer = new Histogram.LogWriter(file, { keyframeInterval: 3 })
+  for (let i = 0; i < 10; i++) {
+    const instance = Histogram(1, 1000)
+    instance.record(1)
+    instance.record((i % 4) * 100 + 1)
+    writer.write({ histogram: instance, startTimestamp: i, endTimestamp: i + 1 })
+  }
+  writer.end(() => {
+    const reader = new Histogram.LogReader(file, { minIntervalMax: 200, startTime: 2, endTime: 8 })
+    const entries = []
+    reader.on('data', (entry) => entries.push(entry))
+    reader.on('end', () => {
+      t.deepEqual(entries.map((entry) => entry.startTimestamp), [2, 3, 6, 7], 'reads the matching entries')
+      t.deepEqual(entries.map((entry) => entry.histogram.max()), [201, 301, 201, 301], 'decodes the matching entries')
+      try {
+        fs.unlinkSync(file)
+      } catch (err) {}
+      t.end()
+    })
+  })
+})
+
+test('log reader async iteration', { skip: !Readable.prototype[Symbol.asyncIterator] }, (t) => {
+  const file = path.join(os.tmpdir(), `hdr-log-iterator-${process.pid}.hlog`)
+  const writer = new Histogram.LogWriter(file)
+  for (let i = 0; i < 5; i++) {
+    const instance = Histogram(1, 100)
+    instance.record(i + 1)
+    writer.write({ histogram: instance, startTimestamp: i, endTimestamp: i + 1 })
+  }
+  writer.end(() => {
+    const iterator = new Histogram.LogReader(file)[Symbol.asyncIterator]()
+    const maxes = []
+    const next = () => iterator.next().then((result) => {
+      if (result.done) {
+        return
+      }
+      t.equal(result.value.tag, undefined, 'untagged entry')
+      maxes.push(result.value.histogram.max())
+      return next()
+    })
+    next().then(() => {
+      t.deepEqual(maxes, [1, 2, 3, 4, 5], 'iterates every entry')
+      try {
+        fs.unlinkSync(file)
+      } catch (err) {}
+      t.end()
+    })
+  })
+})
+
+test('log errors', (t) => {
+  t.plan(2)
+  new Histogram.LogReader(path.join(os.tmpdir(), 'hdr-log-missing.hlog'))
+    .on('error', (err) => t.ok(err, 'missing log errors'))
+    .resume()
+  const file = path.join(os.tmpdir(), `hdr-log-error-${process.pid}.hlog`)
+  new Histogram.LogWriter(file)
+    .on('error', (err) => {
+      t.ok(err, 'missing histogram errors')
+      try {
+        fs.unlinkSync(file)
+      } catch (err) {}
+    })
+    .write({ startTimestamp: 0, endTimestamp: 1 })
+})